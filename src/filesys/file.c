@@ -1,7 +1,7 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 
 /* An open file. */
 struct file 
@@ -11,13 +11,23 @@ struct file
     bool deny_write;            /* Has file_deny_write() been called? */
   };
 
+/* Cache of `struct file's. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) 
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), 0, NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
@@ -28,7 +38,7 @@ file_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL; 
     }
 }
@@ -41,6 +51,22 @@ file_reopen (struct file *file)
   return file_open (inode_reopen (file->inode));
 }
 
+/* Opens and returns a new file for the same inode as FILE, with
+   the same position and the same write denial.
+   Returns a null pointer if unsuccessful. */
+struct file *
+file_duplicate (struct file *file) 
+{
+  struct file *copy = file_reopen (file);
+  if (copy != NULL) 
+    {
+      copy->pos = file->pos;
+      if (file->deny_write)
+        file_deny_write (copy);
+    }
+  return copy;
+}
+
 /* Closes FILE. */
 void
 file_close (struct file *file) 
@@ -49,7 +75,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (file_cache, file); 
     }
 }
 
@@ -84,6 +110,23 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Reads SIZE bytes from FILE into user virtual address BUFFER in
+   page directory PD, starting at the file's current position.
+   The data goes straight from the disk into the user's pages
+   without passing through a kernel buffer.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if end of file is reached or if part of BUFFER is not
+   mapped writable.
+   Advances FILE's position by the number of bytes read. */
+off_t
+file_read_user (struct file *file, uint32_t *pd, void *buffer, off_t size) 
+{
+  off_t bytes_read = inode_read_at_user (file->inode, pd, buffer, size,
+                                         file->pos);
+  file->pos += bytes_read;
+  return bytes_read;
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
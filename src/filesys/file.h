@@ -1,19 +1,24 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdint.h>
 #include "filesys/off_t.h"
 
 struct inode;
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
+struct file *file_duplicate (struct file *);
 void file_close (struct file *);
 struct inode *file_get_inode (struct file *);
 
 /* Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
+off_t file_read_user (struct file *, uint32_t *pd, void *, off_t);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
 
@@ -6,6 +6,10 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -36,6 +40,7 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    unsigned generation;                /* Bumped by each write. */
     struct inode_disk data;             /* Inode content. */
   };
 
@@ -57,11 +62,30 @@ byte_to_sector (const struct inode *inode, off_t pos)
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of `struct inode's, which are a little over 512 bytes
+   and so would waste almost half of a 1 kB malloc() block. */
+static struct kmem_cache *inode_cache;
+
+/* Returns the running thread's sector bounce buffer, allocating
+   it on first use, or a null pointer if memory is not available.
+   The buffer lives until the thread exits, so partial-sector
+   transfers don't pay for a malloc() and free() on every call. */
+static uint8_t *
+get_bounce (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->bounce == NULL)
+    t->bounce = malloc (BLOCK_SECTOR_SIZE);
+  return t->bounce;
+}
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -127,7 +151,7 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
@@ -136,6 +160,7 @@ inode_open (block_sector_t sector)
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  inode->generation = 0;
   inode->removed = false;
   block_read (fs_device, inode->sector, &inode->data);
   return inode;
@@ -181,7 +206,7 @@ inode_close (struct inode *inode)
                             bytes_to_sectors (inode->data.length)); 
         }
 
-      free (inode); 
+      kmem_cache_free (inode_cache, inode); 
     }
 }
 
@@ -202,7 +227,6 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
@@ -229,12 +253,9 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
         {
           /* Read sector into bounce buffer, then partially copy
              into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+          uint8_t *bounce = get_bounce ();
+          if (bounce == NULL)
+            break;
           block_read (fs_device, sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
@@ -244,7 +265,96 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  return bytes_read;
+}
+
+/* Reads SIZE bytes from INODE into user virtual address UBUF in
+   page directory PD, starting at position OFFSET.
+
+   Each destination page is resolved once, with
+   pagedir_get_writable_page(), and full sectors are read
+   straight into its kernel mapping, so each byte is copied only
+   once.  Only the partial sectors at the head and tail of the
+   transfer, and a full sector that straddles two user pages, go
+   through the thread's bounce buffer.
+
+   Returns the number of bytes actually read, which may be less
+   than SIZE if end of file is reached, if a destination page is
+   not mapped writable, or if an error occurs. */
+off_t
+inode_read_at_user (struct inode *inode, uint32_t *pd, void *ubuf_,
+                    off_t size, off_t offset) 
+{
+  uint8_t *ubuf = ubuf_;
+  off_t bytes_read = 0;
+  uint8_t *upage = NULL;        /* Current destination user page. */
+  uint8_t *kpage = NULL;        /* Kernel mapping of UPAGE. */
+
+  while (size > 0) 
+    {
+      /* Disk sector to read, starting byte offset within sector. */
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+
+      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      off_t inode_left = inode_length (inode) - offset;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+      /* Number of bytes to actually copy out of this sector, and
+         the bytes of it that fit in the current user page. */
+      int chunk_size = size < min_left ? size : min_left;
+      uint8_t *udst = ubuf + bytes_read;
+      int page_left, head;
+      if (chunk_size <= 0)
+        break;
+
+      if (pg_round_down (udst) != upage) 
+        {
+          upage = pg_round_down (udst);
+          kpage = pagedir_get_writable_page (pd, upage);
+          if (kpage == NULL)
+            break;
+        }
+      page_left = PGSIZE - pg_ofs (udst);
+
+      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE
+          && page_left >= BLOCK_SECTOR_SIZE)
+        {
+          /* Read full sector directly into the user page. */
+          block_read (fs_device, sector_idx, kpage + pg_ofs (udst));
+        }
+      else 
+        {
+          /* Read sector into bounce buffer, then copy into the
+             user page, spilling into the next page if the chunk
+             straddles a page boundary. */
+          uint8_t *bounce = get_bounce ();
+          if (bounce == NULL)
+            break;
+          block_read (fs_device, sector_idx, bounce);
+
+          head = chunk_size < page_left ? chunk_size : page_left;
+          memcpy (kpage + pg_ofs (udst), bounce + sector_ofs, head);
+          if (head < chunk_size) 
+            {
+              upage += PGSIZE;
+              kpage = pagedir_get_writable_page (pd, upage);
+              if (kpage == NULL) 
+                {
+                  bytes_read += head;
+                  break;
+                }
+              memcpy (kpage, bounce + sector_ofs + head, chunk_size - head);
+            }
+        }
+      
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
 
   return bytes_read;
 }
@@ -260,10 +370,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
+  inode->generation++;
 
   while (size > 0) 
     {
@@ -289,12 +399,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       else 
         {
           /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+          uint8_t *bounce = get_bounce ();
+          if (bounce == NULL)
+            break;
 
           /* If the sector contains data before or after the chunk
              we're writing, then we need to read in the sector
@@ -312,7 +419,6 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
   return bytes_written;
 }
@@ -337,6 +443,23 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Returns INODE's generation, which changes whenever INODE's
+   data may have been written.  Data read from INODE is still
+   current as long as its generation is unchanged. */
+unsigned
+inode_get_generation (const struct inode *inode)
+{
+  return inode->generation;
+}
+
+/* Returns true if INODE has been removed, so that it will be
+   deleted when its last opener closes it. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
@@ -15,9 +16,13 @@ block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+off_t inode_read_at_user (struct inode *, uint32_t *pd, void *,
+                          off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+unsigned inode_get_generation (const struct inode *);
+bool inode_is_removed (const struct inode *);
 off_t inode_length (const struct inode *);
 
 #endif /* filesys/inode.h */
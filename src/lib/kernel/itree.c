@@ -0,0 +1,284 @@
+/* Interval tree.
+
+   See itree.h for basic information. */
+
+#include "itree.h"
+#include "../debug.h"
+
+static int height (const struct itree_elem *);
+static void update (struct itree_elem *);
+static void replace_child (struct itree *, struct itree_elem *old,
+                           struct itree_elem *new);
+static struct itree_elem *rotate_left (struct itree *, struct itree_elem *);
+static struct itree_elem *rotate_right (struct itree *, struct itree_elem *);
+static void rebalance (struct itree *, struct itree_elem *);
+static struct itree_elem *leftmost (struct itree_elem *);
+
+/* Initializes T as an empty interval tree. */
+void
+itree_init (struct itree *t)
+{
+  t->root = NULL;
+  t->elem_cnt = 0;
+}
+
+/* Inserts E into T as the interval [START, END), which must not
+   be empty.  An interval equal to or overlapping ones already in
+   T is inserted anyway; use itree_overlap() first to refuse
+   overlaps. */
+void
+itree_insert (struct itree *t, struct itree_elem *e,
+              uintptr_t start, uintptr_t end)
+{
+  struct itree_elem *parent = NULL;
+  struct itree_elem **link = &t->root;
+
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+  ASSERT (start < end);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      link = start < parent->start ? &parent->left : &parent->right;
+    }
+
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->start = start;
+  e->end = end;
+  e->max_end = end;
+  e->height = 1;
+  *link = e;
+  t->elem_cnt++;
+
+  rebalance (t, parent);
+}
+
+/* Removes E, which must be in T, from T. */
+void
+itree_remove (struct itree *t, struct itree_elem *e)
+{
+  struct itree_elem *fix;
+
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+
+  if (e->left == NULL || e->right == NULL)
+    {
+      fix = e->parent;
+      replace_child (t, e, e->left != NULL ? e->left : e->right);
+    }
+  else
+    {
+      /* Put E's successor, which has no left child, in E's
+         place. */
+      struct itree_elem *s = leftmost (e->right);
+
+      if (s->parent != e)
+        {
+          fix = s->parent;
+          replace_child (t, s, s->right);
+          s->right = e->right;
+          s->right->parent = s;
+        }
+      else
+        fix = s;
+      replace_child (t, e, s);
+      s->left = e->left;
+      s->left->parent = s;
+    }
+  t->elem_cnt--;
+
+  rebalance (t, fix);
+}
+
+/* Returns the element of T with the lowest start whose interval
+   contains VALUE, or a null pointer if no interval does. */
+struct itree_elem *
+itree_lookup (struct itree *t, uintptr_t value)
+{
+  return value < UINTPTR_MAX ? itree_overlap (t, value, value + 1) : NULL;
+}
+
+/* Returns the element of T with the lowest start whose interval
+   overlaps [START, END), or a null pointer if none does. */
+struct itree_elem *
+itree_overlap (struct itree *t, uintptr_t start, uintptr_t end)
+{
+  struct itree_elem *e = t->root;
+
+  /* If any interval on the left reaches past START, then either
+     one of them overlaps or they all begin at or after END, and
+     so do E and everything to its right. */
+  while (e != NULL)
+    {
+      if (e->left != NULL && e->left->max_end > start)
+        e = e->left;
+      else if (e->start >= end)
+        return NULL;
+      else if (e->end > start)
+        return e;
+      else
+        e = e->right;
+    }
+  return NULL;
+}
+
+/* Returns the element after E, in order of start, whose interval
+   overlaps [START, END), or a null pointer if there is none.
+   Together with itree_overlap(), this visits every interval that
+   overlaps a range. */
+struct itree_elem *
+itree_overlap_next (struct itree_elem *e, uintptr_t start, uintptr_t end)
+{
+  for (e = itree_next (e); e != NULL && e->start < end; e = itree_next (e))
+    if (e->end > start)
+      return e;
+  return NULL;
+}
+
+/* Returns the element of T with the lowest start, or a null
+   pointer if T is empty. */
+struct itree_elem *
+itree_first (struct itree *t)
+{
+  return t->root != NULL ? leftmost (t->root) : NULL;
+}
+
+/* Returns the element after E in order of start, or a null
+   pointer if E is the last one. */
+struct itree_elem *
+itree_next (struct itree_elem *e)
+{
+  ASSERT (e != NULL);
+
+  if (e->right != NULL)
+    return leftmost (e->right);
+  while (e->parent != NULL && e->parent->right == e)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+itree_size (struct itree *t)
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool
+itree_empty (struct itree *t)
+{
+  return t->root == NULL;
+}
+
+/* Returns the height of subtree E, which may be null. */
+static int
+height (const struct itree_elem *e)
+{
+  return e != NULL ? e->height : 0;
+}
+
+/* Recomputes E's height and greatest end from its children. */
+static void
+update (struct itree_elem *e)
+{
+  int lh = height (e->left);
+  int rh = height (e->right);
+
+  e->height = (lh > rh ? lh : rh) + 1;
+  e->max_end = e->end;
+  if (e->left != NULL && e->left->max_end > e->max_end)
+    e->max_end = e->left->max_end;
+  if (e->right != NULL && e->right->max_end > e->max_end)
+    e->max_end = e->right->max_end;
+}
+
+/* Makes NEW, which may be null, take OLD's place as a child of
+   OLD's parent, or as the root of T. */
+static void
+replace_child (struct itree *t, struct itree_elem *old,
+               struct itree_elem *new)
+{
+  if (new != NULL)
+    new->parent = old->parent;
+  if (old->parent == NULL)
+    t->root = new;
+  else if (old->parent->left == old)
+    old->parent->left = new;
+  else
+    old->parent->right = new;
+}
+
+/* Rotates E's right child up into E's place and returns it. */
+static struct itree_elem *
+rotate_left (struct itree *t, struct itree_elem *e)
+{
+  struct itree_elem *r = e->right;
+
+  e->right = r->left;
+  if (r->left != NULL)
+    r->left->parent = e;
+  replace_child (t, e, r);
+  r->left = e;
+  e->parent = r;
+  update (e);
+  update (r);
+  return r;
+}
+
+/* Rotates E's left child up into E's place and returns it. */
+static struct itree_elem *
+rotate_right (struct itree *t, struct itree_elem *e)
+{
+  struct itree_elem *l = e->left;
+
+  e->left = l->right;
+  if (l->right != NULL)
+    l->right->parent = e;
+  replace_child (t, e, l);
+  l->right = e;
+  e->parent = l;
+  update (e);
+  update (l);
+  return l;
+}
+
+/* Walks from E, which may be null, up to the root of T, updating
+   each node and rotating where its subtrees' heights differ by
+   more than one. */
+static void
+rebalance (struct itree *t, struct itree_elem *e)
+{
+  while (e != NULL)
+    {
+      int balance;
+
+      update (e);
+      balance = height (e->left) - height (e->right);
+      if (balance > 1)
+        {
+          if (height (e->left->left) < height (e->left->right))
+            rotate_left (t, e->left);
+          e = rotate_right (t, e);
+        }
+      else if (balance < -1)
+        {
+          if (height (e->right->right) < height (e->right->left))
+            rotate_right (t, e->right);
+          e = rotate_left (t, e);
+        }
+      e = e->parent;
+    }
+}
+
+/* Returns the element with the lowest start in subtree E. */
+static struct itree_elem *
+leftmost (struct itree_elem *e)
+{
+  while (e->left != NULL)
+    e = e->left;
+  return e;
+}
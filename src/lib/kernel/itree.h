@@ -0,0 +1,109 @@
+#ifndef __LIB_KERNEL_ITREE_H
+#define __LIB_KERNEL_ITREE_H
+
+/* Interval tree.
+
+   An interval tree holds a set of half-open intervals [START,
+   END) of unsigned integers, such as ranges of virtual
+   addresses, and finds the intervals that contain a given point
+   or that overlap a given range in O(log n) time.
+
+   It is an AVL tree ordered by START, in which each node also
+   records the greatest END anywhere in its subtree.  That is
+   enough to tell, at each node, whether any interval to its left
+   could still overlap the range being looked for, so a lookup
+   only ever follows one path down the tree.  Intervals may
+   overlap one another, although most users keep them disjoint.
+
+   Like lists and hash tables, the tree does not allocate memory.
+   Each structure that can be in an interval tree embeds a struct
+   itree_elem, and the itree_entry macro converts a pointer to
+   that member back into a pointer to the structure.  Refer to
+   lib/kernel/list.h for a detailed explanation of the
+   technique.  For example:
+
+        struct region
+          {
+            struct itree_elem elem;
+            ...
+          };
+
+        struct itree regions;
+        struct region *r = ...;
+
+        itree_init (&regions);
+        itree_insert (&regions, &r->elem, start, end);
+        ...
+        e = itree_lookup (&regions, addr);
+        if (e != NULL)
+          r = itree_entry (e, struct region, elem);
+
+   In-order iteration, from the lowest START to the highest,
+   looks like this:
+
+        struct itree_elem *e;
+
+        for (e = itree_first (&regions); e != NULL; e = itree_next (e))
+          {
+            struct region *r = itree_entry (e, struct region, elem);
+            ...
+          }
+
+   An element's interval can't be changed while it is in a tree;
+   remove it and insert it again instead. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interval tree element. */
+struct itree_elem
+  {
+    struct itree_elem *parent;  /* Parent, or null for the root. */
+    struct itree_elem *left;    /* Left child, with smaller starts. */
+    struct itree_elem *right;   /* Right child, with larger starts. */
+    uintptr_t start;            /* First value in the interval. */
+    uintptr_t end;              /* One past the last value. */
+    uintptr_t max_end;          /* Greatest END in this subtree. */
+    int height;                 /* Height of this subtree, 1 for a leaf. */
+  };
+
+/* Interval tree. */
+struct itree
+  {
+    struct itree_elem *root;    /* Root, or null if empty. */
+    size_t elem_cnt;            /* Number of elements. */
+  };
+
+/* Converts pointer to interval tree element ITREE_ELEM into a
+   pointer to the structure that ITREE_ELEM is embedded inside.
+   Supply the name of the outer structure STRUCT and the member
+   name MEMBER of the element.  See the big comment at the top of
+   the file for an example. */
+#define itree_entry(ITREE_ELEM, STRUCT, MEMBER)                 \
+        ((STRUCT *) ((uint8_t *) &(ITREE_ELEM)->parent          \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+void itree_init (struct itree *);
+
+/* Insertion, deletion. */
+void itree_insert (struct itree *, struct itree_elem *,
+                   uintptr_t start, uintptr_t end);
+void itree_remove (struct itree *, struct itree_elem *);
+
+/* Search. */
+struct itree_elem *itree_lookup (struct itree *, uintptr_t);
+struct itree_elem *itree_overlap (struct itree *,
+                                  uintptr_t start, uintptr_t end);
+struct itree_elem *itree_overlap_next (struct itree_elem *,
+                                       uintptr_t start, uintptr_t end);
+
+/* Iteration, in order of START. */
+struct itree_elem *itree_first (struct itree *);
+struct itree_elem *itree_next (struct itree_elem *);
+
+/* Information. */
+size_t itree_size (struct itree *);
+bool itree_empty (struct itree *);
+
+#endif /* lib/kernel/itree.h */
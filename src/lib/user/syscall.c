@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+bool
+vmstat (struct vmstat *stats)
+{
+  return syscall1 (SYS_VMSTAT, stats);
+}
@@ -0,0 +1,27 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+#include <stdint.h>
+
+/* Paging statistics for one process, as kept by the kernel and
+   returned by the vmstat() system call.
+
+   Each page fault that the kernel resolves counts once, by what
+   it took to bring the page in: a frame already in memory, a
+   zeroed frame, a read from the page's file, a read from swap,
+   or a private copy of a copy-on-write page.  Pages brought in
+   alongside a faulting page, by fault-around, read-ahead, or
+   swap prefetch, are not faults and are not counted. */
+struct vmstat
+  {
+    uint64_t minor_faults;      /* Mapped a frame already in memory. */
+    uint64_t zero_faults;       /* Mapped a zero page. */
+    uint64_t file_faults;       /* Read in from a file. */
+    uint64_t swap_faults;       /* Read in from swap. */
+    uint64_t cow_faults;        /* Copy-on-write page made private. */
+    uint64_t evictions;         /* Pages taken away by the evictor. */
+    uint64_t swap_outs;         /* Evicted pages written to swap. */
+    uint64_t fault_cycles;      /* CPU cycles spent handling faults. */
+  };
+
+#endif /* lib/vmstat.h */
@@ -0,0 +1,260 @@
+/* Inserts intervals into an interval tree in ascending and in
+   random order, looks up points and ranges in it, and removes
+   the intervals again in random order, checking after each
+   change that the tree is still a balanced search tree whose
+   nodes record the right heights and greatest ends, and
+   comparing each search against a search of every interval. */
+
+#include <itree.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+
+#define ELEM_CNT 128
+
+/* An interval. */
+struct interval
+  {
+    struct itree_elem elem;
+    bool in_tree;
+  };
+
+static struct interval intervals[ELEM_CNT];
+
+static void insert_all (struct itree *, bool shuffled);
+static void remove_all (struct itree *);
+static void check_searches (struct itree *);
+static int check_subtree (struct itree_elem *, struct itree_elem *parent,
+                          uintptr_t min_start, uintptr_t max_start);
+static void shuffle (size_t order[]);
+
+void
+test_itree (void) 
+{
+  struct itree t;
+
+  random_init (0);
+  itree_init (&t);
+
+  msg ("insert in ascending order");
+  insert_all (&t, false);
+  check_searches (&t);
+  msg ("remove in random order");
+  remove_all (&t);
+
+  msg ("insert in random order");
+  insert_all (&t, true);
+  check_searches (&t);
+  msg ("remove in random order");
+  remove_all (&t);
+
+  pass ();
+}
+
+/* Returns the start of interval I.  Starts are distinct, so that
+   "the interval with the lowest start" is well defined. */
+static uintptr_t
+start_of (size_t i) 
+{
+  return 10 * i;
+}
+
+/* Returns the end of interval I.  Intervals overlap their
+   neighbours by varying amounts. */
+static uintptr_t
+end_of (size_t i) 
+{
+  return start_of (i) + 5 + 7 * (i % 5);
+}
+
+/* Checks T's structure, and that it holds exactly the intervals
+   marked IN_TREE. */
+static void
+check_tree (struct itree *t) 
+{
+  struct itree_elem *e;
+  size_t cnt = 0, i;
+
+  for (i = 0; i < ELEM_CNT; i++)
+    if (intervals[i].in_tree)
+      cnt++;
+  if (itree_size (t) != cnt)
+    fail ("tree holds %zu intervals, should hold %zu", itree_size (t), cnt);
+  if (itree_empty (t) != (cnt == 0))
+    fail ("itree_empty() returned %d with %zu intervals",
+          itree_empty (t), cnt);
+
+  check_subtree (t->root, NULL, 0, UINTPTR_MAX);
+
+  /* In-order iteration visits the intervals by start. */
+  i = 0;
+  for (e = itree_first (t); e != NULL; e = itree_next (e)) 
+    {
+      struct interval *iv = itree_entry (e, struct interval, elem);
+
+      while (i < ELEM_CNT && !intervals[i].in_tree)
+        i++;
+      if (iv != &intervals[i])
+        fail ("iteration visited interval %zu instead of %zu",
+              (size_t) (iv - intervals), i);
+      i++;
+    }
+  while (i < ELEM_CNT && !intervals[i].in_tree)
+    i++;
+  if (i != ELEM_CNT)
+    fail ("iteration stopped before interval %zu", i);
+}
+
+/* Checks the subtree rooted at E, whose parent should be PARENT
+   and whose starts should lie between MIN_START and MAX_START,
+   and returns its height. */
+static int
+check_subtree (struct itree_elem *e, struct itree_elem *parent,
+               uintptr_t min_start, uintptr_t max_start) 
+{
+  int left_height, right_height, height;
+  uintptr_t max_end;
+
+  if (e == NULL)
+    return 0;
+  if (e->parent != parent)
+    fail ("node [%zu,%zu) has the wrong parent",
+          (size_t) e->start, (size_t) e->end);
+  if (e->start < min_start || e->start > max_start)
+    fail ("node [%zu,%zu) is out of order",
+          (size_t) e->start, (size_t) e->end);
+
+  left_height = check_subtree (e->left, e, min_start, e->start);
+  right_height = check_subtree (e->right, e, e->start, max_start);
+  if (left_height - right_height > 1 || right_height - left_height > 1)
+    fail ("node [%zu,%zu) is unbalanced: heights %d and %d",
+          (size_t) e->start, (size_t) e->end, left_height, right_height);
+  height = (left_height > right_height ? left_height : right_height) + 1;
+  if (e->height != height)
+    fail ("node [%zu,%zu) records height %d, not %d",
+          (size_t) e->start, (size_t) e->end, e->height, height);
+
+  max_end = e->end;
+  if (e->left != NULL && e->left->max_end > max_end)
+    max_end = e->left->max_end;
+  if (e->right != NULL && e->right->max_end > max_end)
+    max_end = e->right->max_end;
+  if (e->max_end != max_end)
+    fail ("node [%zu,%zu) records greatest end %zu, not %zu",
+          (size_t) e->start, (size_t) e->end,
+          (size_t) e->max_end, (size_t) max_end);
+  return height;
+}
+
+/* Inserts every interval into T, in random order if SHUFFLED,
+   otherwise in ascending order, which needs the most
+   rebalancing. */
+static void
+insert_all (struct itree *t, bool shuffled) 
+{
+  size_t order[ELEM_CNT];
+  size_t i;
+
+  for (i = 0; i < ELEM_CNT; i++)
+    order[i] = i;
+  if (shuffled)
+    shuffle (order);
+
+  for (i = 0; i < ELEM_CNT; i++) 
+    {
+      struct interval *iv = &intervals[order[i]];
+
+      itree_insert (t, &iv->elem, start_of (order[i]), end_of (order[i]));
+      iv->in_tree = true;
+      check_tree (t);
+    }
+}
+
+/* Removes every interval from T in random order. */
+static void
+remove_all (struct itree *t) 
+{
+  size_t order[ELEM_CNT];
+  size_t i;
+
+  for (i = 0; i < ELEM_CNT; i++)
+    order[i] = i;
+  shuffle (order);
+
+  for (i = 0; i < ELEM_CNT; i++) 
+    {
+      struct interval *iv = &intervals[order[i]];
+
+      itree_remove (t, &iv->elem);
+      iv->in_tree = false;
+      check_tree (t);
+
+      /* Search a tree with some intervals missing, too. */
+      if (i == ELEM_CNT / 2)
+        check_searches (t);
+    }
+}
+
+/* Checks the search for every interval in T that overlaps
+   [START, END), in order of start, against a search of every
+   interval. */
+static void
+check_overlap (struct itree *t, uintptr_t start, uintptr_t end) 
+{
+  struct itree_elem *e = itree_overlap (t, start, end);
+  size_t i;
+
+  for (i = 0; i < ELEM_CNT; i++)
+    if (intervals[i].in_tree
+        && start_of (i) < end && end_of (i) > start) 
+      {
+        if (e != &intervals[i].elem)
+          fail ("search for [%zu,%zu) missed interval %zu",
+                (size_t) start, (size_t) end, i);
+        e = itree_overlap_next (e, start, end);
+      }
+  if (e != NULL)
+    fail ("search for [%zu,%zu) found [%zu,%zu), which doesn't overlap",
+          (size_t) start, (size_t) end, (size_t) e->start, (size_t) e->end);
+}
+
+/* Checks point lookups and range searches all across T. */
+static void
+check_searches (struct itree *t) 
+{
+  uintptr_t limit = end_of (ELEM_CNT - 1) + 10;
+  uintptr_t x;
+
+  for (x = 0; x < limit; x++) 
+    {
+      struct itree_elem *e = itree_lookup (t, x);
+      struct itree_elem *expected = NULL;
+      size_t i;
+
+      for (i = 0; i < ELEM_CNT; i++)
+        if (intervals[i].in_tree && start_of (i) <= x && x < end_of (i)) 
+          {
+            expected = &intervals[i].elem;
+            break;
+          }
+      if (e != expected)
+        fail ("lookup of %zu returned the wrong interval", (size_t) x);
+
+      check_overlap (t, x, x + 1);
+      check_overlap (t, x, x + 25);
+    }
+}
+
+/* Shuffles the ELEM_CNT elements of ORDER. */
+static void
+shuffle (size_t order[]) 
+{
+  size_t i;
+
+  for (i = 0; i < ELEM_CNT; i++) 
+    {
+      size_t j = i + random_ulong () % (ELEM_CNT - i);
+      size_t tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+}
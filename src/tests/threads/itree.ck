@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(itree) begin
+(itree) insert in ascending order
+(itree) remove in random order
+(itree) insert in random order
+(itree) remove in random order
+(itree) PASS
+(itree) end
+EOF
+pass;
@@ -0,0 +1,161 @@
+/* Allocates more than an arena's worth of blocks of sizes in
+   many of malloc()'s size classes, small and multi-page, and of
+   blocks bigger than any size class, checking that the blocks
+   don't overlap and keep their contents.  Then checks that a
+   block freed from an arena that stays in use is handed out
+   again, and that realloc() keeps a block's contents as it moves
+   between size classes. */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* Sizes to allocate. */
+static const size_t sizes[] =
+  {
+    1, 16, 17, 24, 25, 40, 100, 200, 500, 513, 700, 1000, 2000,
+    3000, 5000, 10000, 16384, 16385, 40000,
+  };
+#define SIZE_CNT (sizeof sizes / sizeof *sizes)
+
+/* Biggest size class. */
+#define MAX_CLASS 16384
+
+/* Most blocks of one size, more than fit in a one-page arena of
+   1-byte blocks. */
+#define MAX_BLOCKS (PGSIZE + 1)
+
+static uint8_t *blocks[MAX_BLOCKS];
+
+static void fill (uint8_t *, size_t size, size_t seed);
+static void check (const uint8_t *, size_t size, size_t seed);
+static int compare_ptrs (const void *, const void *);
+static size_t resize_size (size_t step);
+
+void
+test_malloc_classes (void) 
+{
+  size_t i, j;
+
+  msg ("allocate blocks of %zu sizes", SIZE_CNT);
+  for (i = 0; i < SIZE_CNT; i++) 
+    {
+      size_t size = sizes[i];
+
+      /* Arenas of blocks up to 512 bytes are one page, and those
+         of bigger blocks at most 16 pages, so this many blocks
+         always take more than one arena. */
+      size_t cnt = (size <= 512 ? PGSIZE : 16 * PGSIZE) / size + 1;
+
+      for (j = 0; j < cnt; j++) 
+        {
+          blocks[j] = malloc (size);
+          if (blocks[j] == NULL)
+            fail ("allocating block %zu of %zu bytes failed", j, size);
+          fill (blocks[j], size, j);
+        }
+      for (j = 0; j < cnt; j++)
+        check (blocks[j], size, j);
+
+      qsort (blocks, cnt, sizeof *blocks, compare_ptrs);
+      for (j = 1; j < cnt; j++)
+        if (blocks[j - 1] + size > blocks[j])
+          fail ("%zu-byte blocks %p and %p overlap",
+                size, blocks[j - 1], blocks[j]);
+
+      for (j = 0; j < cnt; j++)
+        free (blocks[j]);
+    }
+
+  /* Blocks bigger than the biggest size class come straight from
+     the page allocator, so skip them here, along with the biggest
+     class, which MEMPROF's block header pushes past it. */
+  msg ("reuse freed blocks");
+  for (i = 0; sizes[i] < MAX_CLASS; i++) 
+    {
+      size_t size = sizes[i];
+      uint8_t *a, *b;
+      uintptr_t freed;
+
+      /* A keeps the arena in use, so that freeing B doesn't
+         give the arena back to the page allocator. */
+      a = malloc (size);
+      b = malloc (size);
+      if (a == NULL || b == NULL)
+        fail ("allocating %zu bytes failed", size);
+      freed = (uintptr_t) b;
+      free (b);
+      b = malloc (size);
+      if ((uintptr_t) b != freed)
+        fail ("freed %zu-byte block %#"PRIxPTR" not reused, got %p",
+              size, freed, b);
+      free (a);
+      free (b);
+    }
+
+  msg ("resize a block across size classes");
+  blocks[0] = malloc (resize_size (0));
+  if (blocks[0] == NULL)
+    fail ("allocating %zu bytes failed", resize_size (0));
+  fill (blocks[0], resize_size (0), 0);
+  for (i = 1; i < 2 * SIZE_CNT - 1; i++) 
+    {
+      size_t old_size = resize_size (i - 1);
+      size_t new_size = resize_size (i);
+      uint8_t *p = realloc (blocks[0], new_size);
+
+      if (p == NULL)
+        fail ("reallocating %zu bytes to %zu failed", old_size, new_size);
+      check (p, old_size < new_size ? old_size : new_size, 0);
+      fill (p, new_size, 0);
+      blocks[0] = p;
+    }
+  free (blocks[0]);
+
+  pass ();
+}
+
+/* Returns the size of the block at STEP of growing it through
+   all of SIZES and then shrinking it back. */
+static size_t
+resize_size (size_t step) 
+{
+  return sizes[step < SIZE_CNT ? step : 2 * SIZE_CNT - 2 - step];
+}
+
+/* Fills the SIZE bytes at P with a pattern that depends on
+   SEED. */
+static void
+fill (uint8_t *p, size_t size, size_t seed) 
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = i * 7 + seed;
+}
+
+/* Checks that the SIZE bytes at P hold the pattern that fill()
+   stored there with SEED. */
+static void
+check (const uint8_t *p, size_t size, size_t seed) 
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != (uint8_t) (i * 7 + seed))
+      fail ("byte %zu of %zu-byte block %p changed", i, size, p);
+}
+
+/* qsort() comparison function for pointers to blocks. */
+static int
+compare_ptrs (const void *a_, const void *b_) 
+{
+  uint8_t *const *a = a_;
+  uint8_t *const *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(malloc-classes) begin
+(malloc-classes) allocate blocks of 19 sizes
+(malloc-classes) reuse freed blocks
+(malloc-classes) resize a block across size classes
+(malloc-classes) PASS
+(malloc-classes) end
+EOF
+pass;
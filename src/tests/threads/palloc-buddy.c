@@ -0,0 +1,155 @@
+/* Allocates and frees multi-page blocks of mixed sizes from the
+   user pool, checking after each step that the buddy allocator's
+   free lists are consistent and fully merged, that each block is
+   aligned on its size rounded up to a power of 2, and that no
+   two blocks overlap.  Once everything is freed, the largest
+   aligned block must be as big as it was at the start, showing
+   that the split blocks merged back together. */
+
+#include <random.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define BLOCK_CNT 24            /* Number of blocks. */
+#define MAX_PAGES 6             /* Most pages in a block. */
+#define MAX_ORDER 10            /* Largest order to try. */
+
+/* A block of pages. */
+struct block
+  {
+    uint8_t *pages;             /* First page, or null if free. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+static struct block blocks[BLOCK_CNT];
+static uint8_t *pool_base;
+
+static void get_block (size_t idx);
+static void put_block (size_t idx);
+static int largest_block (void);
+
+void
+test_palloc_buddy (void) 
+{
+  size_t order[BLOCK_CNT];
+  size_t pool_cnt;
+  int before, after;
+  size_t i;
+
+  random_init (0);
+  pool_base = palloc_user_pool (&pool_cnt);
+  palloc_check ();
+  before = largest_block ();
+
+  msg ("allocate %d blocks", BLOCK_CNT);
+  for (i = 0; i < BLOCK_CNT; i++)
+    get_block (i);
+
+  msg ("free every other block");
+  for (i = 0; i < BLOCK_CNT; i += 2)
+    put_block (i);
+
+  msg ("reallocate them");
+  for (i = 0; i < BLOCK_CNT; i += 2)
+    get_block (i);
+
+  msg ("free all blocks in random order");
+  for (i = 0; i < BLOCK_CNT; i++)
+    order[i] = i;
+  for (i = 0; i < BLOCK_CNT; i++) 
+    {
+      size_t j = i + random_ulong () % (BLOCK_CNT - i);
+      size_t t = order[i];
+      order[i] = order[j];
+      order[j] = t;
+    }
+  for (i = 0; i < BLOCK_CNT; i++)
+    put_block (order[i]);
+
+  after = largest_block ();
+  if (after != before)
+    fail ("largest block was order %d, now order %d", before, after);
+  pass ();
+}
+
+/* Returns the page index of PAGE in the user pool. */
+static size_t
+page_idx (const void *page) 
+{
+  return pg_no (page) - pg_no (pool_base);
+}
+
+/* Allocates block IDX with a random size, checks it, and fills
+   each of its pages with IDX. */
+static void
+get_block (size_t idx) 
+{
+  struct block *b = &blocks[idx];
+  size_t align, i;
+
+  b->page_cnt = random_ulong () % MAX_PAGES + 1;
+  b->pages = palloc_get_multiple (PAL_USER, b->page_cnt);
+  if (b->pages == NULL)
+    fail ("allocating %zu pages failed", b->page_cnt);
+  palloc_check ();
+
+  for (align = 1; align < b->page_cnt; align *= 2)
+    continue;
+  if (page_idx (b->pages) % align != 0)
+    fail ("%zu-page block at page %zu isn't aligned",
+          b->page_cnt, page_idx (b->pages));
+
+  for (i = 0; i < BLOCK_CNT; i++) 
+    {
+      struct block *c = &blocks[i];
+      if (c != b && c->pages != NULL
+          && b->pages < c->pages + c->page_cnt * PGSIZE
+          && c->pages < b->pages + b->page_cnt * PGSIZE)
+        fail ("blocks at pages %zu and %zu overlap",
+              page_idx (b->pages), page_idx (c->pages));
+    }
+
+  memset (b->pages, idx, b->page_cnt * PGSIZE);
+}
+
+/* Checks that block IDX still holds what get_block() put there,
+   then frees it. */
+static void
+put_block (size_t idx) 
+{
+  struct block *b = &blocks[idx];
+  size_t i;
+
+  for (i = 0; i < b->page_cnt * PGSIZE; i++)
+    if (b->pages[i] != idx)
+      fail ("block at page %zu was overwritten", page_idx (b->pages));
+  palloc_free_multiple (b->pages, b->page_cnt);
+  b->pages = NULL;
+  palloc_check ();
+}
+
+/* Returns the order of the largest block of pages, aligned on
+   its size, that can be allocated from the user pool. */
+static int
+largest_block (void) 
+{
+  int k;
+
+  for (k = MAX_ORDER; k > 0; k--) 
+    {
+      size_t page_cnt = (size_t) 1 << k;
+      uint8_t *pages = palloc_get_multiple (PAL_USER, page_cnt);
+      if (pages != NULL) 
+        {
+          bool aligned = page_idx (pages) % page_cnt == 0;
+          palloc_free_multiple (pages, page_cnt);
+          if (aligned)
+            return k;
+        }
+    }
+  return 0;
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(palloc-buddy) begin
+(palloc-buddy) allocate 24 blocks
+(palloc-buddy) free every other block
+(palloc-buddy) reallocate them
+(palloc-buddy) free all blocks in random order
+(palloc-buddy) PASS
+(palloc-buddy) end
+EOF
+pass;
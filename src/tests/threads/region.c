@@ -0,0 +1,98 @@
+/* Allocates blocks of random sizes and alignments from a region,
+   enough to take several chunks, and checks that they are
+   aligned, don't overlap, and keep their contents.  Then checks
+   that an allocation bigger than a page starts a chunk of its
+   own, that releasing to a mark rolls the region back to the
+   mark, and that an impossibly big allocation fails cleanly. */
+
+#include <random.h>
+#include <stdint.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/region.h"
+#include "threads/vaddr.h"
+
+#define BLOCK_CNT 100           /* Number of small blocks. */
+#define MAX_SIZE 200            /* Most bytes in a small block. */
+
+/* A block allocated from the region. */
+struct block
+  {
+    uint8_t *p;                 /* Start. */
+    size_t size;                /* Number of bytes. */
+  };
+
+static struct block blocks[BLOCK_CNT];
+
+void
+test_region (void) 
+{
+  static const size_t aligns[] = {0, 1, 2, 4, 8, 16, 64};
+  struct region *r;
+  struct region_mark m;
+  uint8_t *first, *p;
+  size_t i, j;
+
+  random_init (0);
+  r = region_init (palloc_get_page (PAL_ASSERT));
+
+  msg ("allocate %d small blocks", BLOCK_CNT);
+  for (i = 0; i < BLOCK_CNT; i++) 
+    {
+      struct block *b = &blocks[i];
+      size_t align = aligns[random_ulong () % (sizeof aligns
+                                               / sizeof *aligns)];
+
+      b->size = random_ulong () % MAX_SIZE + 1;
+      b->p = region_alloc (r, b->size, align);
+      if (b->p == NULL)
+        fail ("allocating %zu bytes failed", b->size);
+      if ((uintptr_t) b->p % (align != 0 ? align : sizeof (void *)) != 0)
+        fail ("%zu-byte block %p isn't aligned on %zu bytes",
+              b->size, b->p, align);
+      for (j = 0; j < i; j++)
+        if (b->p < blocks[j].p + blocks[j].size
+            && blocks[j].p < b->p + b->size)
+          fail ("blocks %p and %p overlap", b->p, blocks[j].p);
+      memset (b->p, i, b->size);
+    }
+  for (i = 0; i < BLOCK_CNT; i++)
+    for (j = 0; j < blocks[i].size; j++)
+      if (blocks[i].p[j] != i)
+        fail ("block %p was overwritten", blocks[i].p);
+
+  msg ("allocate more than a page");
+  p = region_alloc (r, 2 * PGSIZE, 0);
+  if (p == NULL)
+    fail ("allocating %d bytes failed", 2 * PGSIZE);
+  if (p != (uint8_t *) (r->chunk + 1) || r->chunk->page_cnt < 3)
+    fail ("%d-byte block %p didn't start a new chunk", 2 * PGSIZE, p);
+  memset (p, 0, 2 * PGSIZE);
+
+  msg ("release to a mark");
+  m = region_mark (r);
+  first = region_alloc (r, 100, 16);
+  if (first == NULL)
+    fail ("allocating 100 bytes failed");
+  for (i = 0; i < 4; i++)
+    if (region_alloc (r, PGSIZE, 0) == NULL)
+      fail ("allocating %d bytes failed", PGSIZE);
+  region_release (r, m);
+  if (r->chunk != m.chunk)
+    fail ("chunks allocated since the mark weren't released");
+  p = region_alloc (r, 100, 16);
+  if (p != first)
+    fail ("block after release is %p, not %p", p, first);
+
+  msg ("allocate too much");
+  if (region_alloc (r, SIZE_MAX, 0) != NULL)
+    fail ("allocating SIZE_MAX bytes succeeded");
+  if (region_alloc (r, SIZE_MAX / 2, 0) != NULL)
+    fail ("allocating SIZE_MAX / 2 bytes succeeded");
+  if (region_alloc (r, 100, 16) == NULL)
+    fail ("allocating 100 bytes after failure failed");
+
+  region_free_all (r);
+  pass ();
+}
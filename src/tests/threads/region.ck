@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(region) begin
+(region) allocate 100 small blocks
+(region) allocate more than a page
+(region) release to a mark
+(region) allocate too much
+(region) PASS
+(region) end
+EOF
+pass;
@@ -0,0 +1,110 @@
+/* Allocates enough objects from an object cache to fill several
+   slabs, checks that they are distinct, aligned, and
+   constructed, and then checks that freed objects, and a slab
+   whose objects are all free, are reused without being
+   constructed again. */
+
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+
+#define OBJ_CNT 200
+#define OBJ_SIZE 100
+#define OBJ_ALIGN 32
+
+/* Value that the constructor stores in each object. */
+#define OBJ_MAGIC 0x0b1ec7ed
+
+/* An object. */
+struct obj
+  {
+    unsigned magic;
+    char data[OBJ_SIZE - sizeof (unsigned)];
+  };
+
+static size_t ctor_cnt;
+
+static void
+obj_ctor (void *obj_) 
+{
+  struct obj *obj = obj_;
+  obj->magic = OBJ_MAGIC;
+  ctor_cnt++;
+}
+
+static struct obj *objs[OBJ_CNT];
+
+/* Returns the number of distinct pages among the objects in
+   OBJS. */
+static size_t
+count_slabs (void) 
+{
+  size_t cnt = 0;
+  size_t i, j;
+
+  for (i = 0; i < OBJ_CNT; i++) 
+    {
+      for (j = 0; j < i; j++)
+        if (pg_round_down (objs[j]) == pg_round_down (objs[i]))
+          break;
+      if (j == i)
+        cnt++;
+    }
+  return cnt;
+}
+
+void
+test_slab (void) 
+{
+  struct kmem_cache *c;
+  size_t slab_cnt, ctor_before, i, j;
+  struct obj *obj;
+
+  c = kmem_cache_create ("test", OBJ_SIZE, OBJ_ALIGN, obj_ctor);
+
+  msg ("allocate %d objects", OBJ_CNT);
+  for (i = 0; i < OBJ_CNT; i++) 
+    {
+      objs[i] = kmem_cache_alloc (c);
+      if (objs[i] == NULL)
+        fail ("allocation %zu failed", i);
+      if ((uintptr_t) objs[i] % OBJ_ALIGN != 0)
+        fail ("object %p isn't aligned", objs[i]);
+      if (objs[i]->magic != OBJ_MAGIC)
+        fail ("object %p isn't constructed", objs[i]);
+      for (j = 0; j < i; j++)
+        if ((uintptr_t) objs[i] < (uintptr_t) objs[j] + OBJ_SIZE
+            && (uintptr_t) objs[j] < (uintptr_t) objs[i] + OBJ_SIZE)
+          fail ("objects %p and %p overlap", objs[i], objs[j]);
+    }
+
+  /* Each object was constructed once, when its slab was made. */
+  slab_cnt = count_slabs ();
+  if (slab_cnt < 2)
+    fail ("%d objects fit in one slab", OBJ_CNT);
+  if (ctor_cnt % slab_cnt != 0 || ctor_cnt < OBJ_CNT
+      || ctor_cnt - OBJ_CNT >= ctor_cnt / slab_cnt)
+    fail ("%zu constructor calls for %d objects in %zu slabs",
+          ctor_cnt, OBJ_CNT, slab_cnt);
+
+  msg ("reuse a freed object");
+  obj = objs[OBJ_CNT / 2];
+  kmem_cache_free (c, obj);
+  objs[OBJ_CNT / 2] = kmem_cache_alloc (c);
+  if (objs[OBJ_CNT / 2] != obj)
+    fail ("freed object %p not reused, got %p", obj, objs[OBJ_CNT / 2]);
+
+  msg ("reuse an empty slab");
+  for (i = 0; i < OBJ_CNT; i++)
+    kmem_cache_free (c, objs[i]);
+  ctor_before = ctor_cnt;
+  obj = kmem_cache_alloc (c);
+  if (obj == NULL || obj->magic != OBJ_MAGIC)
+    fail ("object from empty slab isn't constructed");
+  if (ctor_cnt != ctor_before)
+    fail ("empty slab was constructed again");
+  kmem_cache_free (c, obj);
+
+  pass ();
+}
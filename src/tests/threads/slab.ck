@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(slab) begin
+(slab) allocate 200 objects
+(slab) reuse a freed object
+(slab) reuse an empty slab
+(slab) PASS
+(slab) end
+EOF
+pass;
@@ -38,6 +38,11 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"itree", test_itree},
+    {"slab", test_slab},
+    {"palloc-buddy", test_palloc_buddy},
+    {"malloc-classes", test_malloc_classes},
+    {"region", test_region},
   };
 
 static const char *test_name;
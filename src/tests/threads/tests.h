@@ -32,6 +32,11 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_itree;
+extern test_func test_slab;
+extern test_func test_palloc_buddy;
+extern test_func test_malloc_classes;
+extern test_func test_region;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,53 @@
+/* Forks a child while parent and child share data and stack
+   pages, then has each of them write its copy.  Neither may see
+   the other's writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[3 * 4096];
+
+/* Returns true if all SIZE bytes of BUF are C. */
+static bool
+all_are (const char *buf, size_t size, char c) 
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (buf[i] != c)
+      return false;
+  return true;
+}
+
+void
+test_main (void) 
+{
+  char stack_buf[256];
+  pid_t pid;
+
+  memset (buf, 'p', sizeof buf);
+  memset (stack_buf, 'p', sizeof stack_buf);
+  pid = fork ();
+  if (pid == 0) 
+    {
+      /* Must see the data from before fork(), whatever the
+         parent has written since, and then its own writes. */
+      if (!all_are (buf, sizeof buf, 'p')
+          || !all_are (stack_buf, sizeof stack_buf, 'p'))
+        exit (1);
+      memset (buf, 'c', sizeof buf);
+      memset (stack_buf, 'c', sizeof stack_buf);
+      if (!all_are (buf, sizeof buf, 'c')
+          || !all_are (stack_buf, sizeof stack_buf, 'c'))
+        exit (2);
+      exit (81);
+    }
+
+  memset (buf, 'q', sizeof buf);
+  memset (stack_buf, 'q', sizeof stack_buf);
+  CHECK (wait (pid) == 81, "wait for child");
+  CHECK (all_are (buf, sizeof buf, 'q'), "check data");
+  CHECK (all_are (stack_buf, sizeof stack_buf, 'q'), "check stack");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+fork-cow: exit(81)
+(fork-cow) wait for child
+(fork-cow) check data
+(fork-cow) check stack
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
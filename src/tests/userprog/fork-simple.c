@@ -0,0 +1,16 @@
+/* Forks a child that exits with a known status and waits for
+   it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t pid = fork ();
+
+  if (pid == 0)
+    exit (81);
+  msg ("wait(fork()) = %d", wait (pid));
+}
@@ -0,0 +1,26 @@
+/* Opens a file three times, closes the first descriptor, and
+   opens the file again, which must reuse the closed
+   descriptor. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int h1, h2, h3, h4;
+
+  CHECK ((h1 = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((h2 = open ("sample.txt")) > 1, "open \"sample.txt\" again");
+  CHECK ((h3 = open ("sample.txt")) > 1, "open \"sample.txt\" a third time");
+  msg ("close first descriptor");
+  close (h1);
+  CHECK ((h4 = open ("sample.txt")) > 1, "open \"sample.txt\" once more");
+  if (h4 != h1)
+    fail ("open() returned %d, not closed descriptor %d", h4, h1);
+  msg ("close all descriptors");
+  close (h2);
+  close (h3);
+  close (h4);
+}
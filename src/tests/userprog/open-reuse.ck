@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-reuse) begin
+(open-reuse) open "sample.txt"
+(open-reuse) open "sample.txt" again
+(open-reuse) open "sample.txt" a third time
+(open-reuse) close first descriptor
+(open-reuse) open "sample.txt" once more
+(open-reuse) close all descriptors
+(open-reuse) end
+open-reuse: exit(0)
+EOF
+pass;
@@ -0,0 +1,76 @@
+/* Maps a file, writes to every other page of the mapping, then
+   touches enough memory to push the mapped pages out, so that
+   the dirty ones must be written back to the file and the clean
+   ones dropped.  Checks the data through the mapping, unmaps
+   the file, and checks it again with the read system call. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define PAGE_CNT 8
+#define PAGE_SIZE 4096
+
+static char big[2 * 1024 * 1024];
+
+/* Returns the byte that page PAGE of the file should hold. */
+static char
+expected (size_t page) 
+{
+  return page % 2 == 0 ? 'a' + page : 0;
+}
+
+/* Fails unless PAGE_SIZE bytes at BUF all hold the data for page
+   PAGE of the file. */
+static void
+check_page (const char *buf, size_t page) 
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_SIZE; i++)
+    if (buf[i] != expected (page))
+      fail ("byte %zu of page %zu is %d, not %d",
+            i, page, buf[i], expected (page));
+}
+
+void
+test_main (void)
+{
+  static char buf[PAGE_SIZE];
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  CHECK (create ("data", PAGE_CNT * PAGE_SIZE), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"data\"");
+
+  /* Dirty the even pages and read the odd ones. */
+  msg ("write even pages");
+  for (i = 0; i < PAGE_CNT; i++)
+    if (i % 2 == 0)
+      memset (ACTUAL + i * PAGE_SIZE, expected (i), PAGE_SIZE);
+    else
+      check_page (ACTUAL + i * PAGE_SIZE, i);
+
+  /* Push the mapping out of memory. */
+  msg ("touch other memory");
+  for (i = 0; i < sizeof big; i += PAGE_SIZE)
+    big[i] = i / PAGE_SIZE;
+
+  msg ("check mapping");
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (ACTUAL + i * PAGE_SIZE, i);
+  munmap (map);
+
+  msg ("check file");
+  for (i = 0; i < PAGE_CNT; i++) 
+    {
+      CHECK (read (handle, buf, PAGE_SIZE) == PAGE_SIZE,
+             "read page %zu", i);
+      check_page (buf, i);
+    }
+  close (handle);
+}
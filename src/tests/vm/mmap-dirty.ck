@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-dirty) begin
+(mmap-dirty) create "data"
+(mmap-dirty) open "data"
+(mmap-dirty) mmap "data"
+(mmap-dirty) write even pages
+(mmap-dirty) touch other memory
+(mmap-dirty) check mapping
+(mmap-dirty) check file
+(mmap-dirty) read page 0
+(mmap-dirty) read page 1
+(mmap-dirty) read page 2
+(mmap-dirty) read page 3
+(mmap-dirty) read page 4
+(mmap-dirty) read page 5
+(mmap-dirty) read page 6
+(mmap-dirty) read page 7
+(mmap-dirty) end
+EOF
+pass;
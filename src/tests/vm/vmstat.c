@@ -0,0 +1,55 @@
+/* Checks that vmstat() counts the page faults that the process
+   takes: zero-fill faults for untouched data pages, file faults
+   for a mapped file, and copy-on-write faults in a child that
+   writes pages shared with its parent by fork(). */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+static char buf[16 * 4096];
+
+void
+test_main (void)
+{
+  struct vmstat before, after;
+  int handle;
+  size_t i;
+  pid_t child;
+
+  CHECK (vmstat (&before), "vmstat");
+
+  /* Fill untouched data pages. */
+  for (i = 0; i < sizeof buf; i += 4096)
+    buf[i] = 'a';
+  CHECK (vmstat (&after), "vmstat after touching data");
+  CHECK (after.zero_faults > before.zero_faults, "zero-fill faults counted");
+  before = after;
+
+  /* Read a mapped file. */
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (mmap (handle, ACTUAL) != MAP_FAILED, "mmap \"sample.txt\"");
+  if (memcmp (ACTUAL, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  CHECK (vmstat (&after), "vmstat after reading file");
+  CHECK (after.file_faults > before.file_faults, "file faults counted");
+
+  /* Write shared pages in a child.  The child exits with 81 if
+     its writes were counted as copy-on-write faults. */
+  child = fork ();
+  if (child == 0)
+    {
+      if (!vmstat (&before))
+        exit (1);
+      for (i = 0; i < sizeof buf; i += 4096)
+        buf[i] = 'b';
+      if (!vmstat (&after) || after.cow_faults <= before.cow_faults)
+        exit (2);
+      exit (81);
+    }
+  CHECK (wait (child) == 81, "copy-on-write faults counted in child");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vmstat) begin
+(vmstat) vmstat
+(vmstat) vmstat after touching data
+(vmstat) zero-fill faults counted
+(vmstat) open "sample.txt"
+(vmstat) mmap "sample.txt"
+(vmstat) vmstat after reading file
+(vmstat) file faults counted
+(vmstat) copy-on-write faults counted in child
+(vmstat) end
+EOF
+pass;
@@ -15,6 +15,7 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -26,6 +27,7 @@
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -37,6 +39,12 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/ksm.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -51,6 +59,9 @@ static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
+
+/* -zswap: Pages of compressed swap cache, 0 for none. */
+static size_t zswap_pages;
 #endif
 #endif /* FILESYS */
 
@@ -59,6 +70,7 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static uint32_t cpu_features (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -114,11 +126,21 @@ main (void)
   exception_init ();
   syscall_init ();
 #endif
+#ifdef VM
+  frame_init ();
+  page_init ();
+#endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+#ifdef USERPROG
+  pagedir_init ();
+#endif
+#ifdef VM
+  ksm_init ();
+#endif
 
 #ifdef FILESYS
   /* Initialize file system. */
@@ -126,6 +148,9 @@ main (void)
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init (zswap_pages);
+#endif
 
   printf ("Boot complete.\n");
   
@@ -150,16 +175,44 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID feature flags, as returned by cpu_features().
+   See [IA32-v2a] "CPUID--CPU Identification". */
+#define CPUID_PSE 0x00000008    /* 4 MB pages. */
+#define CPUID_PGE 0x00002000    /* Global pages. */
+
+/* CR4 bits.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR4_PSE 0x00000010      /* Page Size Extensions. */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   The kernel mapping is the same in every page directory, so if
+   the CPU supports it we mark it global, which keeps it in the
+   TLB when a process switch reloads CR3.  We also map each
+   4 MB-aligned chunk of RAM with a single 4 MB page where we
+   can, which saves page tables and TLB entries.  The chunk that
+   holds the kernel's code is the exception: it keeps 4 kB pages
+   so that the code can stay read-only. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpu_features ();
+  uint32_t global = features & CPUID_PGE ? PTE_G : 0;
+  uint32_t cr4;
+
+  /* Turn on the paging features we'll use, before we use them. */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (features & CPUID_PSE)
+    cr4 |= CR4_PSE;
+  if (features & CPUID_PGE)
+    cr4 |= CR4_PGE;
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4));
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -171,13 +224,24 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if ((features & CPUID_PSE)
+          && pte_idx == 0
+          && init_ram_pages - page >= PTSPAN / PGSIZE
+          && (pde_idx < pd_no (&_start)
+              || pde_idx > pd_no (&_end_kernel_text - 1)))
+        {
+          pd[pde_idx] = paddr | PTE_P | PTE_W | PTE_PS | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -188,6 +252,28 @@ paging_init (void)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
+/* Returns the feature flags that the CPUID instruction reports
+   in EDX for leaf 1, or 0 if the CPU doesn't have CPUID. */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t flags, toggled, eax, ebx, ecx, edx;
+
+  /* CPUID is available if the ID flag in EFLAGS can be
+     changed. */
+  asm volatile ("pushfl; popl %0" : "=r" (flags));
+  asm volatile ("pushl %1; popfl; pushfl; popl %0"
+                : "=r" (toggled) : "r" (flags ^ FLAG_ID) : "cc");
+  asm volatile ("pushl %0; popfl" : : "r" (flags) : "cc");
+  if (((flags ^ toggled) & FLAG_ID) == 0)
+    return 0;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return edx;
+}
+
 /* Breaks the kernel command line into words and returns them as
    an argv-like array. */
 static char **
@@ -250,6 +336,10 @@ parse_options (char **argv)
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-zswap"))
+        zswap_pages = atoi (value);
+      else if (!strcmp (name, "-vmstat"))
+        page_exit_stats = true;
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
@@ -375,6 +465,8 @@ usage (void)
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -zswap=COUNT       Cache swap in COUNT pages of compressed RAM.\n"
+          "  -vmstat            Print paging statistics at process exit.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
@@ -5,42 +5,73 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memprof.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
+   The size of each request, in bytes, is rounded up to the
+   nearest size class and assigned to the "descriptor" that
+   manages blocks of that size.  Size classes go up by quarter
+   powers of 2 (..., 64, 80, 96, 112, 128, 160, ...), so that
+   rounding up wastes at most a fifth of a block, up to
+   MAX_BLOCK bytes.  The descriptor keeps a list of free blocks.
+   If the free list is nonempty, one of its blocks is used to
    satisfy the request.
 
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
+   Otherwise, a new run of pages, called an "arena", is obtained
+   from the page allocator (if none is available, malloc()
+   returns a null pointer).  The new arena is divided into
+   blocks, all of which are added to the descriptor's free list.
+   Then we return one of the new blocks.  Arenas for blocks of up
+   to SMALL_BLOCK bytes are one page long and begin with their
+   `struct arena' header.  Bigger blocks would waste too much of
+   a page beside the header, so their arenas are as many pages as
+   it takes to divide them into blocks with little left over, and
+   their headers are allocated separately, from a small-block
+   descriptor.  Every page of an arena is tagged with its header
+   (see palloc_set_tag()), which is how we find the arena of a
+   block.
 
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   We handle blocks bigger than MAX_BLOCK by allocating just
+   enough contiguous pages with the page allocator and giving
+   them a separate arena header that records the number of
+   pages.  Such blocks are page-aligned.
+
+   If MEMPROF is defined, each block begins with a `struct
+   prof_hdr' that records its size and the call site that
+   allocated it, for the memory profiler (see memprof.h), and
+   each descriptor counts its arenas.  The header makes big
+   blocks no longer page-aligned. */
+
+/* Biggest block with a descriptor. */
+#define MAX_BLOCK (16 * 1024)
+
+/* Biggest block whose arenas hold their own headers. */
+#define SMALL_BLOCK (PGSIZE / 8)
+
+/* Longest arena, in pages. */
+#define MAX_ARENA_PAGES 16
 
 /* Descriptor. */
 struct desc
   {
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    size_t arena_pages;         /* Number of pages in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+#ifdef MEMPROF
+    size_t arena_cnt;           /* Number of arenas. */
+    size_t peak_arena_cnt;      /* Most of ARENA_CNT at once. */
+#endif
   };
 
 /* Magic number for detecting arena corruption. */
@@ -52,6 +83,7 @@ struct arena
     unsigned magic;             /* Always set to ARENA_MAGIC. */
     struct desc *desc;          /* Owning descriptor, null for big block. */
     size_t free_cnt;            /* Free blocks; pages in big block. */
+    uint8_t *blocks;            /* First block. */
   };
 
 /* Free block. */
@@ -60,10 +92,25 @@ struct block
     struct list_elem free_elem; /* Free list element. */
   };
 
+#ifdef MEMPROF
+/* Profiling header at the start of each allocated block. */
+struct prof_hdr
+  {
+    void *site;                 /* Allocating call site. */
+    size_t size;                /* Bytes requested. */
+  };
+#endif
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[40];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+static void init_desc (size_t block_size);
+static void *alloc (size_t size, void *site);
+static void *raw_malloc (size_t size);
+static void raw_free (void *p);
+static struct arena *new_arena (struct desc *);
+static void free_arena (struct arena *);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -71,23 +118,84 @@ static struct block *arena_to_block (struct arena *, size_t idx);
 void
 malloc_init (void) 
 {
-  size_t block_size;
+  size_t base, quarter;
+
+  init_desc (16);
+  init_desc (24);
+  for (base = 32; base <= MAX_BLOCK; base *= 2)
+    for (quarter = 0; quarter < 4 && base + quarter * base / 4 <= MAX_BLOCK;
+         quarter++)
+      init_desc (base + quarter * base / 4);
+}
+
+/* Adds a descriptor for blocks of BLOCK_SIZE bytes. */
+static void
+init_desc (size_t block_size) 
+{
+  struct desc *d = &descs[desc_cnt++];
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+  d->block_size = block_size;
+  if (block_size <= SMALL_BLOCK)
     {
-      struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
+      d->arena_pages = 1;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
     }
+  else
+    {
+      /* Take the shortest arena that leaves no more than a
+         sixteenth of itself unused. */
+      size_t pages;
+
+      for (pages = DIV_ROUND_UP (block_size, PGSIZE);
+           pages < MAX_ARENA_PAGES; pages++)
+        if (pages * PGSIZE % block_size * 16 <= pages * PGSIZE)
+          break;
+      d->arena_pages = pages;
+      d->blocks_per_arena = pages * PGSIZE / block_size;
+    }
+  list_init (&d->free_list);
+  lock_init (&d->lock);
+#ifdef MEMPROF
+  d->arena_cnt = d->peak_arena_cnt = 0;
+#endif
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return alloc (size, MEMPROF_CALLER ());
+}
+
+/* Does the work of malloc() for a caller at SITE, which is a
+   null pointer unless MEMPROF is defined. */
+static void *
+alloc (size_t size, void *site UNUSED) 
+{
+#ifdef MEMPROF
+  struct prof_hdr *h;
+
+  if (size == 0 || size + sizeof *h < size)
+    return NULL;
+  h = raw_malloc (size + sizeof *h);
+  if (h == NULL)
+    return NULL;
+  h->site = site;
+  h->size = size;
+  memprof_alloc (site, size);
+  return h + 1;
+#else
+  return raw_malloc (size);
+#endif
+}
+
+/* Obtains and returns a new block of at least SIZE bytes,
+   without a profiling header.  Returns a null pointer if memory
+   is not available. */
+static void *
+raw_malloc (size_t size) 
 {
   struct desc *d;
   struct block *b;
@@ -105,18 +213,28 @@ malloc (size_t size)
   if (d == descs + desc_cnt) 
     {
       /* SIZE is too big for any descriptor.
-         Allocate enough pages to hold SIZE plus an arena. */
-      size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
+         Allocate just enough pages to hold SIZE. */
+      size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+      void *pages;
+
+      a = raw_malloc (sizeof *a);
       if (a == NULL)
         return NULL;
+      pages = palloc_get_multiple (0, page_cnt);
+      if (pages == NULL)
+        {
+          raw_free (a);
+          return NULL;
+        }
 
       /* Initialize the arena to indicate a big block of PAGE_CNT
          pages, and return it. */
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
-      return a + 1;
+      a->blocks = pages;
+      palloc_set_tag (pages, page_cnt, a);
+      return pages;
     }
 
   lock_acquire (&d->lock);
@@ -126,18 +244,14 @@ malloc (size_t size)
     {
       size_t i;
 
-      /* Allocate a page. */
-      a = palloc_get_page (0);
+      a = new_arena (d);
       if (a == NULL) 
         {
           lock_release (&d->lock);
           return NULL; 
         }
 
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
+      /* Add the arena's blocks to the free list. */
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
@@ -153,6 +267,45 @@ malloc (size_t size)
   return b;
 }
 
+/* Allocates and returns a new, entirely free arena for
+   descriptor D, or a null pointer if memory is not available. */
+static struct arena *
+new_arena (struct desc *d) 
+{
+  struct arena *a;
+  void *pages;
+
+  if (d->block_size <= SMALL_BLOCK)
+    {
+      a = pages = palloc_get_page (0);
+      if (a == NULL)
+        return NULL;
+      a->blocks = (uint8_t *) (a + 1);
+    }
+  else
+    {
+      a = raw_malloc (sizeof *a);
+      if (a == NULL)
+        return NULL;
+      pages = palloc_get_multiple (0, d->arena_pages);
+      if (pages == NULL)
+        {
+          raw_free (a);
+          return NULL;
+        }
+      a->blocks = pages;
+    }
+  a->magic = ARENA_MAGIC;
+  a->desc = d;
+  a->free_cnt = d->blocks_per_arena;
+  palloc_set_tag (pages, d->arena_pages, a);
+#ifdef MEMPROF
+  if (++d->arena_cnt > d->peak_arena_cnt)
+    d->peak_arena_cnt = d->arena_cnt;
+#endif
+  return a;
+}
+
 /* Allocates and return A times B bytes initialized to zeroes.
    Returns a null pointer if memory is not available. */
 void *
@@ -167,22 +320,26 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = alloc (size, MEMPROF_CALLER ());
   if (p != NULL)
     memset (p, 0, size);
 
   return p;
 }
 
-/* Returns the number of bytes allocated for BLOCK. */
+/* Returns the number of bytes of BLOCK that its user may use. */
 static size_t
 block_size (void *block) 
 {
+#ifdef MEMPROF
+  return ((struct prof_hdr *) block - 1)->size;
+#else
   struct block *b = block;
   struct arena *a = block_to_arena (b);
   struct desc *d = a->desc;
 
-  return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+  return d != NULL ? d->block_size : PGSIZE * a->free_cnt;
+#endif
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -201,7 +358,7 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = alloc (new_size, MEMPROF_CALLER ());
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -217,6 +374,22 @@ realloc (void *old_block, size_t new_size)
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) 
+{
+#ifdef MEMPROF
+  if (p != NULL)
+    {
+      struct prof_hdr *h = (struct prof_hdr *) p - 1;
+      memprof_free (h->site, h->size);
+      p = h;
+    }
+#endif
+  raw_free (p);
+}
+
+/* Frees block P, which must have been allocated with
+   raw_malloc(). */
+static void
+raw_free (void *p) 
 {
   if (p != NULL)
     {
@@ -249,34 +422,80 @@ free (void *p)
                   struct block *b = arena_to_block (a, i);
                   list_remove (&b->free_elem);
                 }
-              palloc_free_page (a);
+              free_arena (a);
             }
 
           lock_release (&d->lock);
         }
       else
         {
-          /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
+          /* It's a big block.  Free its pages and its header. */
+          palloc_free_multiple (a->blocks, a->free_cnt);
+          raw_free (a);
           return;
         }
     }
 }
+
+/* Gives the pages of arena A, whose blocks are all free and off
+   its descriptor's free list, back to the page allocator, along
+   with A's header. */
+static void
+free_arena (struct arena *a) 
+{
+  struct desc *d = a->desc;
+
+#ifdef MEMPROF
+  d->arena_cnt--;
+#endif
+  if (d->block_size <= SMALL_BLOCK)
+    palloc_free_page (a);
+  else
+    {
+      palloc_free_multiple (a->blocks, d->arena_pages);
+      raw_free (a);
+    }
+}
+
+#ifdef MEMPROF
+/* Prints the arenas of each size class that has ever had one.
+   Doesn't take the descriptors' locks, so that it can be called
+   while shutting down from any context, so the counts may be
+   slightly off if other threads are allocating. */
+void
+malloc_print_stats (void) 
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->peak_arena_cnt > 0)
+      {
+        size_t free_cnt = list_size (&d->free_list);
+
+        printf ("memprof: %zu-byte blocks: %zu of %zu used, "
+                "%zu %zu-page arenas, %zu peak\n",
+                d->block_size, d->arena_cnt * d->blocks_per_arena - free_cnt,
+                d->arena_cnt * d->blocks_per_arena, d->arena_cnt,
+                d->arena_pages, d->peak_arena_cnt);
+      }
+}
+#endif
 
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
 {
-  struct arena *a = pg_round_down (b);
+  struct arena *a = palloc_get_tag (pg_round_down (b));
 
   /* Check that the arena is valid. */
   ASSERT (a != NULL);
   ASSERT (a->magic == ARENA_MAGIC);
 
   /* Check that the block is properly aligned for the arena. */
+  ASSERT ((uint8_t *) b >= a->blocks);
   ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+          || ((uint8_t *) b - a->blocks) % a->desc->block_size == 0);
+  ASSERT (a->desc != NULL || (uint8_t *) b == a->blocks);
 
   return a;
 }
@@ -288,7 +507,5 @@ arena_to_block (struct arena *a, size_t idx)
   ASSERT (a != NULL);
   ASSERT (a->magic == ARENA_MAGIC);
   ASSERT (idx < a->desc->blocks_per_arena);
-  return (struct block *) ((uint8_t *) a
-                           + sizeof *a
-                           + idx * a->desc->block_size);
+  return (struct block *) (a->blocks + idx * a->desc->block_size);
 }
@@ -0,0 +1,120 @@
+#include "threads/memprof.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+
+#ifdef MEMPROF
+/* Call sites are kept in a fixed hash table, since the profiler
+   can't allocate memory itself.  Sites that don't fit are lumped
+   together in the entry for a null site. */
+#define SITE_CNT 512
+
+/* Allocations made from one call site. */
+struct site
+  {
+    void *pc;                   /* Return address of the call. */
+    uint64_t alloc_cnt;         /* Number of allocations. */
+    uint64_t total_bytes;       /* Bytes ever allocated. */
+    size_t cur_bytes;           /* Bytes allocated and not freed. */
+    size_t peak_bytes;          /* Most of CUR_BYTES at once. */
+  };
+
+static struct site sites[SITE_CNT];
+static struct site other_site;
+
+/* Returns the entry for PC, adding one if necessary.  Interrupts
+   must be off. */
+static struct site *
+find_site (void *pc)
+{
+  size_t start = ((uintptr_t) pc >> 2) % SITE_CNT;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < SITE_CNT; i++)
+    {
+      struct site *s = &sites[(start + i) % SITE_CNT];
+      if (s->pc == pc)
+        return s;
+      if (s->pc == NULL)
+        {
+          s->pc = pc;
+          return s;
+        }
+    }
+  return &other_site;
+}
+
+/* Records that SITE allocated SIZE bytes. */
+void
+memprof_alloc (void *site, size_t size)
+{
+  enum intr_level old_level = intr_disable ();
+  struct site *s = find_site (site);
+
+  s->alloc_cnt++;
+  s->total_bytes += size;
+  s->cur_bytes += size;
+  if (s->cur_bytes > s->peak_bytes)
+    s->peak_bytes = s->cur_bytes;
+  intr_set_level (old_level);
+}
+
+/* Records that SIZE bytes that SITE allocated were freed. */
+void
+memprof_free (void *site, size_t size)
+{
+  enum intr_level old_level = intr_disable ();
+  struct site *s = find_site (site);
+
+  ASSERT (s->cur_bytes >= size);
+  s->cur_bytes -= size;
+  intr_set_level (old_level);
+}
+
+/* Prints the page pools' use, the malloc() arenas, and each call
+   site's allocations, biggest current use first. */
+void
+memprof_dump (void)
+{
+  static bool printed[SITE_CNT];
+  size_t i;
+
+  palloc_print_stats ();
+  malloc_print_stats ();
+
+  /* Selection sort, since there's nowhere to put a copy. */
+  for (i = 0; i < SITE_CNT; i++)
+    printed[i] = false;
+  for (;;)
+    {
+      struct site *s = NULL;
+      size_t best = 0;
+
+      for (i = 0; i < SITE_CNT; i++)
+        if (sites[i].pc != NULL && !printed[i]
+            && (s == NULL || sites[i].cur_bytes > s->cur_bytes))
+          {
+            s = &sites[i];
+            best = i;
+          }
+      if (s == NULL)
+        break;
+      printed[best] = true;
+      printf ("memprof: %p: %zu bytes now, %zu peak, "
+              "%"PRIu64" allocations of %"PRIu64" bytes\n",
+              s->pc, s->cur_bytes, s->peak_bytes,
+              s->alloc_cnt, s->total_bytes);
+    }
+  if (other_site.alloc_cnt > 0)
+    printf ("memprof: other sites: %zu bytes now, %zu peak, "
+            "%"PRIu64" allocations of %"PRIu64" bytes\n",
+            other_site.cur_bytes, other_site.peak_bytes,
+            other_site.alloc_cnt, other_site.total_bytes);
+}
+#endif /* MEMPROF */
@@ -0,0 +1,29 @@
+#ifndef THREADS_MEMPROF_H
+#define THREADS_MEMPROF_H
+
+/* Kernel memory profiling.
+
+   A kernel built with MEMPROF defined, by adding -DMEMPROF to
+   DEFINES in the build directory's Make.vars, records the memory
+   that each call site of malloc(), calloc(), realloc(),
+   palloc_get_page(), and palloc_get_multiple() has allocated and
+   not yet freed, along with the page pools' use and the malloc()
+   arenas of each size class.  memprof_dump() prints it all, and
+   so does shutdown.  Call sites are printed as code addresses,
+   which the "backtrace" utility translates into function names
+   and line numbers. */
+
+#include <stddef.h>
+
+#ifdef MEMPROF
+/* Code address of the caller of the function that uses it. */
+#define MEMPROF_CALLER() __builtin_return_address (0)
+
+void memprof_alloc (void *site, size_t size);
+void memprof_free (void *site, size_t size);
+void memprof_dump (void);
+#else
+#define MEMPROF_CALLER() NULL
+#endif
+
+#endif /* threads/memprof.h */
@@ -2,12 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memprof.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -23,14 +26,75 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each allocated page also has a reference count, which starts
+   out at 1.  Pages shared between several owners, such as user
+   frames shared copy-on-write after fork(), take extra
+   references with palloc_page_ref() and drop them with
+   palloc_page_unref(), which frees the page along with its last
+   reference.
+
+   Free pages are managed by a binary buddy allocator.  A pool's
+   free pages are divided into blocks of 2**K pages, for orders K
+   from 0 to MAX_ORDER, each starting at a page index that is a
+   multiple of its size, and each order has a list of its free
+   blocks.  An allocation of N pages takes a block of the
+   smallest order that holds N pages, splitting a bigger block in
+   halves as necessary, and frees the pages past N at once.  A
+   free block merges with its "buddy", the other half of the
+   block of the next order up, whenever that is free too.  Both
+   take O(log n) time.  The bookkeeping lives in an array beside
+   the pool, not in the free pages, so that free pages can stay
+   zeroed.  The free lists are protected by disabling interrupts,
+   not by the pool's lock, because pages are also freed by the
+   scheduler with interrupts off.  The lock protects the
+   reference counts.
+
+   Rather than zeroing PAL_ZERO pages on the spot, we try to hand
+   out free pages that are already zero.  The idle thread calls
+   palloc_zero_idle() to zero free pages in time that would
+   otherwise be spent halted, and each pool's `zero_map' and
+   `zero_list' record which free pages are known to be zero.
+
+   Define PALLOC_DEBUG to check each pool's free lists after
+   every allocation and free, or call palloc_check() to check
+   them once.  Define MEMPROF to track the pages allocated by
+   each caller and each pool's high-water mark (see memprof.h). */
+
+/* Largest block order: 2**MAX_ORDER pages. */
+#define MAX_ORDER 10
+
+/* Bookkeeping for one page of a pool. */
+struct page_info
+  {
+    struct list_elem free_elem;         /* In `free_lists', if ORDER >= 0. */
+    struct list_elem zero_elem;         /* In `zero_list', if zero and free. */
+    void *tag;                          /* Set by palloc_set_tag(). */
+    int8_t order;                       /* Order of free block here, or -1. */
+#ifdef MEMPROF
+    void *site;                         /* Allocating call site. */
+#endif
+  };
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    struct lock lock;                   /* Protects `ref_cnt'. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *zero_map;            /* Free pages known to be zero. */
+    struct list zero_list;              /* Free pages known to be zero. */
+    size_t zero_hint;                   /* Where to look for pages to zero. */
+    bool zero_done;                     /* All free pages zero? */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks, by order. */
+    struct page_info *info;             /* Bookkeeping for each page. */
+    uint32_t *ref_cnt;                  /* Reference count of each page. */
     uint8_t *base;                      /* Base of pool. */
+#ifdef MEMPROF
+    const char *name;                   /* Name, for printing. */
+    size_t used_cnt;                    /* Number of pages allocated. */
+    size_t peak_cnt;                    /* Most of USED_CNT at once. */
+#endif
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +103,17 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static struct pool *page_to_pool (void *page);
+static void *get_pages (enum palloc_flags, size_t page_cnt, void *site);
+static bool zero_free_page (struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static size_t buddy_alloc_scan (struct pool *, size_t page_cnt);
+static void buddy_take (struct pool *, size_t page_idx);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void free_block (struct pool *, size_t page_idx, int order);
+static void mark_used (struct pool *, size_t page_idx, size_t page_cnt);
+static void check_pool (struct pool *);
+static void verify_pool (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -69,17 +144,66 @@ palloc_init (size_t user_page_limit)
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return get_pages (flags, page_cnt, MEMPROF_CALLER ());
+}
+
+/* Obtains a single free page and returns its kernel virtual
+   address.
+   If PAL_USER is set, the page is obtained from the user pool,
+   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   then the page is filled with zeros.  If no pages are
+   available, returns a null pointer, unless PAL_ASSERT is set in
+   FLAGS, in which case the kernel panics. */
+void *
+palloc_get_page (enum palloc_flags flags) 
+{
+  return get_pages (flags, 1, MEMPROF_CALLER ());
+}
+
+/* Does the work of palloc_get_multiple() for a caller at SITE,
+   which is a null pointer unless MEMPROF is defined. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, void *site UNUSED)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  old_level = intr_disable ();
+  page_idx = BITMAP_ERROR;
+  if ((flags & PAL_ZERO) && page_cnt == 1 && !list_empty (&pool->zero_list))
+    {
+      /* Take a page that is already zero. */
+      struct page_info *pi = list_entry (list_front (&pool->zero_list),
+                                         struct page_info, zero_elem);
+      page_idx = pi - pool->info;
+      buddy_take (pool, page_idx);
+      flags &= ~PAL_ZERO;
+    }
+  if (page_idx == BITMAP_ERROR)
+    page_idx = buddy_alloc (pool, page_cnt);
+  if (page_idx != BITMAP_ERROR)
+    {
+      size_t i;
+
+      mark_used (pool, page_idx, page_cnt);
+      for (i = 0; i < page_cnt; i++)
+        pool->ref_cnt[page_idx + i] = 1;
+#ifdef MEMPROF
+      for (i = 0; i < page_cnt; i++)
+        pool->info[page_idx + i].site = site;
+      pool->used_cnt += page_cnt;
+      if (pool->used_cnt > pool->peak_cnt)
+        pool->peak_cnt = pool->used_cnt;
+#endif
+    }
+  check_pool (pool);
+  intr_set_level (old_level);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -88,6 +212,9 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
+#ifdef MEMPROF
+      memprof_alloc (site, PGSIZE * page_cnt);
+#endif
       if (flags & PAL_ZERO)
         memset (pages, 0, PGSIZE * page_cnt);
     }
@@ -100,63 +227,189 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
-/* Obtains a single free page and returns its kernel virtual
-   address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
-void *
-palloc_get_page (enum palloc_flags flags) 
-{
-  return palloc_get_multiple (flags, 1);
-}
-
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
+  enum intr_level old_level;
   struct pool *pool;
-  size_t page_idx;
+  size_t page_idx, i;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
+  pool = page_to_pool (pages);
   page_idx = pg_no (pages) - pg_no (pool->base);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+  memset (pool->ref_cnt + page_idx, 0, page_cnt * sizeof *pool->ref_cnt);
+  for (i = page_idx; i < page_idx + page_cnt; i++)
+    {
+      pool->info[i].tag = NULL;
+#ifdef MEMPROF
+      memprof_free (pool->info[i].site, PGSIZE);
+      pool->info[i].site = NULL;
+#endif
+    }
+#ifdef MEMPROF
+  pool->used_cnt -= page_cnt;
+#endif
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  buddy_free (pool, page_idx, page_cnt);
+  pool->zero_done = false;
+  check_pool (pool);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
 void
 palloc_free_page (void *page) 
 {
+  ASSERT (palloc_page_ref_cnt (page) == 1);
   palloc_free_multiple (page, 1);
 }
 
+/* Adds a reference to PAGE, which must be allocated. */
+void
+palloc_page_ref (void *page) 
+{
+  struct pool *pool = page_to_pool (page);
+  size_t page_idx = pg_no (page) - pg_no (pool->base);
+
+  lock_acquire (&pool->lock);
+  ASSERT (pool->ref_cnt[page_idx] > 0 && pool->ref_cnt[page_idx] < UINT32_MAX);
+  pool->ref_cnt[page_idx]++;
+  lock_release (&pool->lock);
+}
+
+/* Drops a reference to PAGE.  If that was the last reference,
+   frees PAGE and returns true; otherwise returns false. */
+bool
+palloc_page_unref (void *page) 
+{
+  struct pool *pool = page_to_pool (page);
+  size_t page_idx = pg_no (page) - pg_no (pool->base);
+  bool last;
+
+  lock_acquire (&pool->lock);
+  ASSERT (pool->ref_cnt[page_idx] > 0);
+  last = --pool->ref_cnt[page_idx] == 0;
+  lock_release (&pool->lock);
+
+  if (last) 
+    palloc_free_multiple (page, 1);
+  return last;
+}
+
+/* Returns the number of references to PAGE, which must be
+   allocated.  The answer may be stale by the time the caller
+   looks at it unless it holds the only reference. */
+unsigned
+palloc_page_ref_cnt (const void *page) 
+{
+  struct pool *pool = page_to_pool ((void *) page);
+  return pool->ref_cnt[pg_no (page) - pg_no (pool->base)];
+}
+
+/* Tags each of the PAGE_CNT allocated pages starting at PAGES
+   with TAG, for the allocator that carved them up to find its
+   bookkeeping from an address inside them.  Freeing a page
+   clears its tag. */
+void
+palloc_set_tag (void *pages, size_t page_cnt, void *tag) 
+{
+  struct pool *pool = page_to_pool (pages);
+  size_t page_idx = pg_no (pages) - pg_no (pool->base);
+  size_t i;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+  for (i = page_idx; i < page_idx + page_cnt; i++)
+    pool->info[i].tag = tag;
+}
+
+/* Returns the tag of allocated PAGE set by palloc_set_tag(), or a
+   null pointer if it has none. */
+void *
+palloc_get_tag (const void *page) 
+{
+  struct pool *pool = page_to_pool ((void *) page);
+  return pool->info[pg_no (page) - pg_no (pool->base)].tag;
+}
+
+/* Zeroes a free page that isn't known to be zero yet, so that a
+   later PAL_ZERO allocation can skip zeroing it, and returns
+   true.  Returns false if there is no such page, or if a pool is
+   busy.  Meant to be called by the idle thread. */
+bool
+palloc_zero_idle (void) 
+{
+  return zero_free_page (&user_pool) || zero_free_page (&kernel_pool);
+}
+
+/* Checks that both pools' free lists are consistent with their
+   used pages and fully merged, and panics if not.  For tests;
+   see check_pool() for checking on every call. */
+void
+palloc_check (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  verify_pool (&kernel_pool);
+  verify_pool (&user_pool);
+  intr_set_level (old_level);
+}
+
+/* Returns the first page of the user pool and stores the number
+   of pages in the pool into *PAGE_CNT. */
+void *
+palloc_user_pool (size_t *page_cnt) 
+{
+  *page_cnt = bitmap_size (user_pool.used_map);
+  return user_pool.base;
+}
+
+#ifdef MEMPROF
+/* Prints how many of each pool's pages are in use now and how
+   many were in use at most. */
+void
+palloc_print_stats (void) 
+{
+  struct pool *pools[] = {&kernel_pool, &user_pool};
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    {
+      struct pool *p = pools[i];
+      size_t page_cnt = bitmap_size (p->used_map);
+      printf ("memprof: %s: %zu pages, %zu used, %zu free, %zu peak\n",
+              p->name, page_cnt, p->used_cnt, page_cnt - p->used_cnt,
+              p->peak_cnt);
+    }
+}
+#endif
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map, zero_map, reference counts,
+     and page bookkeeping at its base.  Calculate the space needed
+     for them and subtract it from the pool's size. */
+  size_t bm_size = ROUND_UP (bitmap_buf_size (page_cnt), sizeof (uint32_t));
+  size_t info_ofs = ROUND_UP (2 * bm_size + page_cnt * sizeof (uint32_t),
+                              sizeof (struct page_info));
+  size_t bm_pages = DIV_ROUND_UP (info_ofs
+                                  + page_cnt * sizeof (struct page_info),
+                                  PGSIZE);
+  size_t i;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,8 +418,317 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->zero_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + bm_size,
+                                      bm_size);
+  list_init (&p->zero_list);
+  for (i = 0; i <= MAX_ORDER; i++)
+    list_init (&p->free_lists[i]);
+  p->ref_cnt = (uint32_t *) ((uint8_t *) base + 2 * bm_size);
+  p->info = (struct page_info *) ((uint8_t *) base + info_ofs);
   p->base = base + bm_pages * PGSIZE;
+
+  /* Every page starts out free. */
+  for (i = 0; i < page_cnt; i++) 
+    {
+      p->info[i].tag = NULL;
+      p->info[i].order = -1;
+#ifdef MEMPROF
+      p->info[i].site = NULL;
+#endif
+    }
+#ifdef MEMPROF
+  p->name = name;
+  p->used_cnt = p->peak_cnt = 0;
+#endif
+  buddy_free (p, 0, page_cnt);
+  check_pool (p);
+}
+
+/* Zeroes a free page of POOL that isn't in its zero_map and
+   adds it there.  Returns true if successful, false if there is
+   no such page.
+
+   The free lists are protected by disabling interrupts, which
+   suits the idle thread, since it can't block.  It takes the
+   page out of the free lists while it zeroes it. */
+static bool
+zero_free_page (struct pool *pool) 
+{
+  size_t page_cnt = bitmap_size (pool->used_map);
+  size_t page_idx = BITMAP_ERROR;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  if (!pool->zero_done) 
+    {
+      for (i = 0; i < page_cnt; i++) 
+        {
+          size_t idx = (pool->zero_hint + i) % page_cnt;
+          if (!bitmap_test (pool->used_map, idx)
+              && !bitmap_test (pool->zero_map, idx)) 
+            {
+              page_idx = idx;
+              break;
+            }
+        }
+      if (page_idx != BITMAP_ERROR) 
+        {
+          buddy_take (pool, page_idx);
+          bitmap_mark (pool->used_map, page_idx);
+          pool->zero_hint = page_idx + 1;
+        }
+      else
+        pool->zero_done = true;
+    }
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  bitmap_reset (pool->used_map, page_idx);
+  bitmap_mark (pool->zero_map, page_idx);
+  list_push_back (&pool->zero_list, &pool->info[page_idx].zero_elem);
+  free_block (pool, page_idx, 0);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Takes PAGE_CNT contiguous free pages from POOL's free lists
+   and returns the index of the first, or BITMAP_ERROR if there
+   is no such run.  Interrupts must be off. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) 
+{
+  size_t page_idx;
+  int order, k;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (order = 0; ((size_t) 1 << order) < page_cnt; order++)
+    if (order == MAX_ORDER)
+      return buddy_alloc_scan (pool, page_cnt);
+
+  /* Take the first free block at least as big as we need... */
+  for (k = order; k <= MAX_ORDER; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k > MAX_ORDER)
+    return order > 0 ? buddy_alloc_scan (pool, page_cnt) : BITMAP_ERROR;
+  page_idx = list_entry (list_pop_front (&pool->free_lists[k]),
+                         struct page_info, free_elem) - pool->info;
+  pool->info[page_idx].order = -1;
+
+  /* ...split off its upper halves until it is just big enough... */
+  while (k > order) 
+    {
+      k--;
+      pool->info[page_idx + ((size_t) 1 << k)].order = k;
+      list_push_front (&pool->free_lists[k],
+                       &pool->info[page_idx + ((size_t) 1 << k)].free_elem);
+    }
+
+  /* ...and give back the pages past PAGE_CNT. */
+  if (page_cnt < ((size_t) 1 << order))
+    buddy_free (pool, page_idx + page_cnt,
+                ((size_t) 1 << order) - page_cnt);
+  return page_idx;
+}
+
+/* Takes PAGE_CNT contiguous free pages from POOL's free lists a
+   page at a time and returns the index of the first, or
+   BITMAP_ERROR if there is no such run.  This is the slow path
+   for runs that are bigger than the largest block, or that fall
+   across block boundaries because no aligned block is free.
+   Interrupts must be off. */
+static size_t
+buddy_alloc_scan (struct pool *pool, size_t page_cnt) 
+{
+  size_t page_idx = bitmap_scan (pool->used_map, 0, page_cnt, false);
+  size_t i;
+
+  if (page_idx != BITMAP_ERROR)
+    for (i = 0; i < page_cnt; i++)
+      buddy_take (pool, page_idx + i);
+  return page_idx;
+}
+
+/* Takes free page PAGE_IDX out of POOL's free lists, splitting
+   the block that contains it and giving back the rest.
+   Interrupts must be off. */
+static void
+buddy_take (struct pool *pool, size_t page_idx) 
+{
+  size_t block = page_idx;
+  int k;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!bitmap_test (pool->used_map, page_idx));
+
+  /* Find the free block that contains the page. */
+  for (k = 0; k <= MAX_ORDER; k++) 
+    {
+      block = page_idx & ~(((size_t) 1 << k) - 1);
+      if (pool->info[block].order == k)
+        break;
+    }
+  ASSERT (k <= MAX_ORDER);
+  list_remove (&pool->info[block].free_elem);
+  pool->info[block].order = -1;
+
+  /* Split it, keeping the half with the page each time. */
+  while (k > 0) 
+    {
+      size_t half;
+
+      k--;
+      half = (size_t) 1 << k;
+      if (page_idx < block + half)
+        free_block (pool, block + half, k);
+      else 
+        {
+          free_block (pool, block, k);
+          block += half;
+        }
+    }
+}
+
+/* Puts the PAGE_CNT pages starting at PAGE_IDX in POOL back in
+   its free lists, as the biggest aligned blocks that cover
+   them.  Interrupts must be off. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  while (page_cnt > 0) 
+    {
+      int order = 0;
+
+      while (order < MAX_ORDER
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX in POOL in
+   its free lists, merging it with its buddy for as long as the
+   buddy is free too.  Interrupts must be off. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) 
+{
+  size_t page_cnt = bitmap_size (pool->used_map);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (order < MAX_ORDER) 
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy + ((size_t) 1 << order) > page_cnt
+          || pool->info[buddy].order != order)
+        break;
+      list_remove (&pool->info[buddy].free_elem);
+      pool->info[buddy].order = -1;
+      if (buddy < page_idx)
+        page_idx = buddy;
+      order++;
+    }
+  pool->info[page_idx].order = order;
+  list_push_front (&pool->free_lists[order], &pool->info[page_idx].free_elem);
+}
+
+/* Marks the PAGE_CNT pages starting at PAGE_IDX in POOL, just
+   taken from its free lists, as in use and not known to be
+   zero. */
+static void
+mark_used (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  size_t i;
+
+  ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  for (i = page_idx; i < page_idx + page_cnt; i++)
+    if (bitmap_test (pool->zero_map, i)) 
+      {
+        bitmap_reset (pool->zero_map, i);
+        list_remove (&pool->info[i].zero_elem);
+      }
+}
+
+/* Checks POOL with verify_pool() if PALLOC_DEBUG is defined,
+   otherwise does nothing.  Interrupts must be off. */
+static void
+check_pool (struct pool *pool UNUSED) 
+{
+#ifdef PALLOC_DEBUG
+  verify_pool (pool);
+#endif
+}
+
+/* Checks that POOL's free lists describe exactly its free pages,
+   in aligned blocks that are fully merged, and that its zero
+   list holds exactly its free pages that are known to be zero.
+   Panics if not.  Interrupts must be off. */
+static void
+verify_pool (struct pool *pool) 
+{
+  size_t page_cnt = bitmap_size (pool->used_map);
+  size_t free_cnt = 0, zero_cnt = 0;
+  struct list_elem *e;
+  int k;
+
+  for (k = 0; k <= MAX_ORDER; k++)
+    for (e = list_begin (&pool->free_lists[k]);
+         e != list_end (&pool->free_lists[k]); e = list_next (e)) 
+      {
+        size_t idx = list_entry (e, struct page_info, free_elem) - pool->info;
+        size_t size = (size_t) 1 << k;
+        size_t buddy = idx ^ size;
+
+        if (pool->info[idx].order != k || idx % size != 0
+            || idx + size > page_cnt
+            || !bitmap_none (pool->used_map, idx, size))
+          PANIC ("palloc: bad free block at page %zu, order %d", idx, k);
+        if (k < MAX_ORDER && buddy + size <= page_cnt
+            && pool->info[buddy].order == k)
+          PANIC ("palloc: unmerged buddies at pages %zu and %zu",
+                 idx, buddy);
+        free_cnt += size;
+      }
+  if (free_cnt != bitmap_count (pool->used_map, 0, page_cnt, false))
+    PANIC ("palloc: free lists hold %zu pages, %zu are free",
+           free_cnt, bitmap_count (pool->used_map, 0, page_cnt, false));
+
+  for (e = list_begin (&pool->zero_list); e != list_end (&pool->zero_list);
+       e = list_next (e)) 
+    {
+      size_t idx = list_entry (e, struct page_info, zero_elem) - pool->info;
+      if (bitmap_test (pool->used_map, idx)
+          || !bitmap_test (pool->zero_map, idx))
+        PANIC ("palloc: bad zero page %zu", idx);
+      zero_cnt++;
+    }
+  if (zero_cnt != bitmap_count (pool->zero_map, 0, page_cnt, true))
+    PANIC ("palloc: zero list holds %zu pages, %zu are zero",
+           zero_cnt, bitmap_count (pool->zero_map, 0, page_cnt, true));
+}
+
+/* Returns the pool that PAGE belongs to. */
+static struct pool *
+page_to_pool (void *page) 
+{
+  if (page_from_pool (&kernel_pool, page))
+    return &kernel_pool;
+  else if (page_from_pool (&user_pool, page))
+    return &user_pool;
+  else
+    NOT_REACHED ();
 }
 
 /* Returns true if PAGE was allocated from POOL,
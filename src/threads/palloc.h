@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -16,5 +17,16 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_page_ref (void *);
+bool palloc_page_unref (void *);
+unsigned palloc_page_ref_cnt (const void *);
+void palloc_set_tag (void *, size_t page_cnt, void *tag);
+void *palloc_get_tag (const void *);
+bool palloc_zero_idle (void);
+void *palloc_user_pool (size_t *page_cnt);
+void palloc_check (void);
+#ifdef MEMPROF
+void palloc_print_stats (void);
+#endif
 
 #endif /* threads/palloc.h */
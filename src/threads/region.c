@@ -0,0 +1,143 @@
+#include "threads/region.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Region allocator.
+
+   Some kernel operations, such as starting a process, need
+   several pieces of scratch memory that all become garbage at
+   once when the operation is done.  Allocating each piece with
+   malloc() and freeing it again costs a lock and a free-list
+   update apiece, and makes every error path free each piece it
+   has so far.  A region instead hands out memory by bumping a
+   pointer through a page, and gives it all back with one call to
+   region_free_all().
+
+   A region lives at the start of the page passed to
+   region_init(), from which it allocates first.  When an
+   allocation doesn't fit in what is left, the region obtains a
+   new "chunk" of pages from the page allocator, big enough for
+   the allocation, and allocates from that from then on.  The
+   chunks are chained together, newest first, so that they can
+   all be freed later.
+
+   Allocations can be nested in scopes: region_mark() records how
+   far the region has allocated, and region_release() frees
+   everything allocated since, including any chunks obtained in
+   the meantime.
+
+   A region has no lock.  It belongs to one thread at a time. */
+
+static struct region_chunk *new_chunk (struct region *, size_t page_cnt);
+
+/* Makes a region out of PAGE, a page obtained with
+   palloc_get_page(), and returns it.  The region lives in PAGE
+   and owns it from then on: region_free_all() frees it. */
+struct region *
+region_init (void *page)
+{
+  struct region_chunk *c = page;
+  struct region *r = (struct region *) (c + 1);
+
+  ASSERT (page != NULL);
+  ASSERT (pg_ofs (page) == 0);
+
+  c->prev = NULL;
+  c->page_cnt = 1;
+  r->chunk = c;
+  r->next = (char *) (r + 1);
+  r->end = (char *) page + PGSIZE;
+  return r;
+}
+
+/* Allocates SIZE bytes from region R, aligned on an ALIGN-byte
+   boundary, or on a word boundary if ALIGN is 0, and returns
+   them.  The memory is not initialized.  Returns a null pointer
+   if memory is not available. */
+void *
+region_alloc (struct region *r, size_t size, size_t align)
+{
+  char *p;
+
+  if (align == 0)
+    align = sizeof (void *);
+  ASSERT ((align & (align - 1)) == 0);
+
+  p = (char *) ROUND_UP ((uintptr_t) r->next, align);
+  if (p > r->end || size > (size_t) (r->end - p))
+    {
+      /* Doesn't fit in this chunk.  Start a new one. */
+      size_t need = sizeof (struct region_chunk) + align - 1 + size;
+      if (need < size || new_chunk (r, DIV_ROUND_UP (need, PGSIZE)) == NULL)
+        return NULL;
+      p = (char *) ROUND_UP ((uintptr_t) r->next, align);
+    }
+  r->next = p + size;
+  return p;
+}
+
+/* Returns a mark for how far region R has allocated, for passing
+   to region_release(). */
+struct region_mark
+region_mark (const struct region *r)
+{
+  struct region_mark m;
+
+  m.chunk = r->chunk;
+  m.next = r->next;
+  return m;
+}
+
+/* Frees everything allocated from region R since M was returned
+   by region_mark(), giving back any chunks obtained since. */
+void
+region_release (struct region *r, struct region_mark m)
+{
+  while (r->chunk != m.chunk)
+    {
+      struct region_chunk *c = r->chunk;
+
+      ASSERT (c->prev != NULL);
+      r->chunk = c->prev;
+      palloc_free_multiple (c, c->page_cnt);
+    }
+  r->next = m.next;
+  r->end = (char *) r->chunk + r->chunk->page_cnt * PGSIZE;
+}
+
+/* Frees region R and everything allocated from it, including the
+   page that R was made from. */
+void
+region_free_all (struct region *r)
+{
+  struct region_chunk *c = r->chunk;
+
+  /* R lives in the oldest chunk, which is freed last. */
+  while (c != NULL)
+    {
+      struct region_chunk *prev = c->prev;
+      palloc_free_multiple (c, c->page_cnt);
+      c = prev;
+    }
+}
+
+/* Obtains a chunk of PAGE_CNT pages and makes it region R's
+   current chunk.  Returns the new chunk, or a null pointer if
+   memory is not available. */
+static struct region_chunk *
+new_chunk (struct region *r, size_t page_cnt)
+{
+  struct region_chunk *c = palloc_get_multiple (0, page_cnt);
+
+  if (c == NULL)
+    return NULL;
+  c->prev = r->chunk;
+  c->page_cnt = page_cnt;
+  r->chunk = c;
+  r->next = (char *) (c + 1);
+  r->end = (char *) c + page_cnt * PGSIZE;
+  return c;
+}
@@ -0,0 +1,38 @@
+#ifndef THREADS_REGION_H
+#define THREADS_REGION_H
+
+#include <stddef.h>
+
+/* A region allocator, for scratch memory that a kernel operation
+   needs until it is done.  See region.c for details. */
+
+/* A run of pages that a region allocates from. */
+struct region_chunk
+  {
+    struct region_chunk *prev;  /* Previous chunk, or null. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+/* A region. */
+struct region
+  {
+    struct region_chunk *chunk; /* Chunk being allocated from. */
+    char *next;                 /* Next free byte in CHUNK. */
+    char *end;                  /* End of CHUNK. */
+  };
+
+/* A point in a region's allocations, to which the region can
+   later be rolled back. */
+struct region_mark
+  {
+    struct region_chunk *chunk;
+    char *next;
+  };
+
+struct region *region_init (void *page);
+void *region_alloc (struct region *, size_t size, size_t align);
+struct region_mark region_mark (const struct region *);
+void region_release (struct region *, struct region_mark);
+void region_free_all (struct region *);
+
+#endif /* threads/region.h */
@@ -0,0 +1,257 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   malloc() rounds every request up to one of its size classes,
+   which wastes up to a fifth of each block, and serializes every
+   request of a size class on one lock.  A kernel object that is allocated and
+   freed often, such as an inode or an open file, can instead get
+   a cache of its own, created with kmem_cache_create(), whose
+   objects are exactly as big as it asks for.
+
+   A cache carves pages, called "slabs", into objects of its
+   size.  Each slab begins with a header that holds a stack of
+   the indexes of its free objects, followed by the objects
+   themselves.  The cache keeps its slabs on three lists: those
+   with free and used objects, from which allocations come first;
+   those that are full; and those that are entirely free, of
+   which it keeps at most EMPTY_MAX around for the next burst of
+   allocations, giving the rest back to the page allocator.
+
+   A cache may have a constructor, which is called once for each
+   object when its slab is created.  The free-object stack lives
+   in the header, not in the objects, so an object keeps its
+   contents while it is free.  A user of a cache with a
+   constructor must free each object in its constructed state,
+   and in return every object it allocates is already in that
+   state. */
+
+/* A cache of objects of one size. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for debugging. */
+    size_t obj_size;            /* Bytes per object, a multiple of ALIGN. */
+    size_t obj_ofs;             /* Offset of the first object in a slab. */
+    size_t obj_cnt;             /* Objects per slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct list partial;        /* Slabs with some objects free. */
+    struct list full;           /* Slabs with no objects free. */
+    struct list empty;          /* Slabs with all objects free. */
+    size_t empty_cnt;           /* Number of slabs in `empty'. */
+    struct lock lock;           /* Protects all of the above. */
+  };
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Empty slabs to keep in each cache. */
+#define EMPTY_MAX 1
+
+/* A slab: a page of objects, headed by this structure. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects, FREE_CNT long. */
+  };
+
+static struct slab *new_slab (struct kmem_cache *);
+static struct slab *obj_to_slab (struct kmem_cache *, void *);
+static void *slab_obj (struct kmem_cache *, struct slab *, size_t idx);
+
+/* Creates and returns a cache of objects of SIZE bytes each,
+   aligned on ALIGN-byte boundaries, or on word boundaries if
+   ALIGN is 0.  If CTOR is non-null, it is called for each new
+   object, and the cache's users must only free objects in the
+   state that CTOR leaves them.  NAME is used for debugging and
+   must remain valid as long as the cache.  Panics if memory is
+   not available, since caches are created during
+   initialization. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  size_t cnt;
+
+  if (align == 0)
+    align = sizeof (void *);
+  ASSERT ((align & (align - 1)) == 0);
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("%s: can't allocate object cache", name);
+  c->name = name;
+  c->obj_size = ROUND_UP (size, align);
+
+  /* Fit as many objects as we can after the header and its
+     free-object stack. */
+  cnt = (PGSIZE - sizeof (struct slab)) / (c->obj_size + sizeof (uint16_t));
+  while (cnt > 0
+         && (ROUND_UP (sizeof (struct slab) + cnt * sizeof (uint16_t), align)
+             + cnt * c->obj_size) > PGSIZE)
+    cnt--;
+  if (cnt == 0)
+    PANIC ("%s: %zu-byte objects don't fit in a slab", name, size);
+  c->obj_cnt = cnt;
+  c->obj_ofs = ROUND_UP (sizeof (struct slab) + cnt * sizeof (uint16_t),
+                         align);
+
+  c->ctor = ctor;
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  c->empty_cnt = 0;
+  lock_init (&c->lock);
+  return c;
+}
+
+/* Obtains and returns an object from cache C, in the state that
+   C's constructor, if any, leaves it.  Returns a null pointer if
+   memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  /* Prefer a partly used slab, then an empty one, and make a new
+     one only if there is neither. */
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    {
+      s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+      c->empty_cnt--;
+      list_push_front (&c->partial, &s->elem);
+    }
+  else
+    {
+      s = new_slab (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  obj = slab_obj (c, s, s->free[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  Ignores a null OBJ. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+  s = obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     it has to stay constructed. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->obj_size);
+#endif
+
+  lock_acquire (&c->lock);
+
+  ASSERT (s->free_cnt < c->obj_cnt);
+  s->free[s->free_cnt++] = ((uint8_t *) obj - (uint8_t *) s - c->obj_ofs)
+                           / c->obj_size;
+  if (s->free_cnt == c->obj_cnt)
+    {
+      /* Every object in S is free now. */
+      list_remove (&s->elem);
+      if (c->empty_cnt < EMPTY_MAX)
+        {
+          list_push_front (&c->empty, &s->elem);
+          c->empty_cnt++;
+        }
+      else
+        palloc_free_page (s);
+    }
+  else if (s->free_cnt == 1)
+    {
+      /* S was full. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  lock_release (&c->lock);
+}
+
+/* Allocates a slab for cache C and constructs its objects.
+   Returns the new slab, with all of its objects free, or a null
+   pointer if memory is not available. */
+static struct slab *
+new_slab (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->obj_cnt;
+
+  /* Hand out objects from the start of the slab first. */
+  for (i = 0; i < c->obj_cnt; i++)
+    {
+      s->free[i] = c->obj_cnt - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor (slab_obj (c, s, i));
+    }
+  return s;
+}
+
+/* Returns the slab that OBJ, an object of cache C, is inside. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid and belongs to C. */
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  /* Check that the object is properly aligned for the slab. */
+  ASSERT (pg_ofs (obj) >= c->obj_ofs);
+  ASSERT ((pg_ofs (obj) - c->obj_ofs) % c->obj_size == 0);
+
+  return s;
+}
+
+/* Returns object IDX within slab S of cache C. */
+static void *
+slab_obj (struct kmem_cache *c, struct slab *s, size_t idx)
+{
+  ASSERT (idx < c->obj_cnt);
+  return (uint8_t *) s + c->obj_ofs + idx * c->obj_size;
+}
@@ -0,0 +1,14 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Initializes a newly allocated object. */
+typedef void kmem_ctor_func (void *obj);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      size_t align, kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *);
+
+#endif /* threads/slab.h */
@@ -233,14 +233,20 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      list_push_front (&thread_current ()->locks, &lock->elem);
+      lock->holder = thread_current ();
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -303,6 +303,7 @@ thread_create (const char *name, int priority,
     }
   }
   #ifdef USERPROG
+  t->parent = thread_current ();
   list_push_back(&thread_current ()->children, &t->parent_elem);
   #endif
 
@@ -400,6 +401,9 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+#ifdef FILESYS
+  free (thread_current ()->bounce);
+#endif
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -524,9 +528,12 @@ init_thread (struct thread *t, const char *name, int priority)
     list_init (&t->children);
     sema_init (&t->finished_flag, 0);
     sema_init (&t->allowed_finish, 0);
+    sema_init (&t->load_done, 0);
     t->ret_status = -1;
-    t->fd = 2;
-    list_init(&t->file_elems);
+  #endif
+  #ifdef VM
+    itree_init (&t->regions);
+    lock_init (&t->vm_lock);
   #endif
   t->magic = THREAD_MAGIC;
   list_push_back (&all_list, &t->allelem);
@@ -676,6 +683,22 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Rather than halting, zero a free page for palloc if one
+         needs it.  Interrupts stay on while we do, so that the
+         timer and devices aren't held off, and blocking again
+         before the next page lets any thread that became ready in
+         the meantime run first. */
+      intr_enable ();
+      if (palloc_zero_idle ())
+        continue;
+
+      /* An interrupt may have readied a thread while interrupts
+         were on.  Run it rather than halting until the next
+         one. */
+      intr_disable ();
+      if (!list_empty (&ready_list))
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
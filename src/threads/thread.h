@@ -3,8 +3,10 @@
 
 #include <debug.h>
 #include <list.h>
+#include <itree.h>
 #include <FixedPoint.h>
 #include <stdint.h>
+#include <vmstat.h>
 #include "threads/synch.h"
 #include "filesys/file.h"
 
@@ -106,6 +108,38 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct thread *parent;              /* Creator, null for none. */
+    struct list children;               /* Threads we created. */
+    struct list_elem parent_elem;       /* Element in parent's `children'. */
+    struct semaphore finished_flag;     /* Upped when the process exits. */
+    struct semaphore allowed_finish;    /* Upped once the parent is done with us. */
+    struct semaphore load_done;         /* Upped once load() returns. */
+    bool load_success;                  /* Whether load() succeeded. */
+    int ret_status;                     /* Exit status. */
+    struct file *executable;            /* Running executable, write-denied. */
+
+    /* Owned by userprog/syscall.c. */
+    struct file **files;                /* Open files, indexed by descriptor. */
+    struct bitmap *fd_map;              /* Descriptors in use. */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct itree regions;               /* Demand-paged regions, by address. */
+    struct lock vm_lock;                /* Keeps the evictor away. */
+    struct vmstat vmstat;               /* Paging statistics. */
+
+    /* Owned by vm/frame.c. */
+    size_t frame_cnt;                   /* Frames we own. */
+    size_t frame_quota;                 /* Frames to keep, 0 if unset. */
+    unsigned fault_cnt;                 /* Page faults taken. */
+    unsigned window_faults;             /* Page faults this window. */
+    int64_t window_start;               /* Window start, in timer ticks. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/inode.c. */
+    uint8_t *bounce;                    /* Sector bounce buffer, or null. */
 #endif
 
     /* Owned by thread.c. */
@@ -2,14 +2,23 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+#ifdef VM
+static uint64_t read_tsc (void);
+#endif
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -126,6 +135,7 @@ page_fault (struct intr_frame *f)
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
   void *fault_addr;  /* Fault address. */
+  uint32_t *pd = thread_current ()->pagedir;
 
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -148,6 +158,39 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  if (is_user_vaddr (fault_addr) && pd != NULL)
+    {
+      uint64_t start;
+      bool handled;
+
+      /* A user fault holds no locks, so it is a safe point to
+         account for the fault and, if memory is overcommitted,
+         suspend the process. */
+      if (not_present && user)
+        frame_note_fault ();
+
+      /* A write to a copy-on-write page shared since fork() gets
+         a private, writable copy of the page and then retries.
+         The first touch of a demand-paged page, or the next touch
+         of an evicted one, brings it in. */
+      start = read_tsc ();
+      if (not_present)
+        handled = page_load (fault_addr, write);
+      else
+        handled = write && page_unshare (fault_addr);
+      thread_current ()->vmstat.fault_cycles += read_tsc () - start;
+      if (handled)
+        return;
+    }
+#else
+  /* A write to a copy-on-write page shared since fork() gets a
+     private, writable copy of the page and then retries. */
+  if (!not_present && write && is_user_vaddr (fault_addr) && pd != NULL
+      && pagedir_unshare (pd, pg_round_down (fault_addr)))
+    return;
+#endif
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -159,3 +202,15 @@ page_fault (struct intr_frame *f)
   kill (f);
 }
 
+#ifdef VM
+/* Returns the CPU's time-stamp counter, which counts clock
+   cycles. */
+static uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+#endif
@@ -3,11 +3,77 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
+
+/* Caches of page directory and page table pages.
+
+   Creating a process needs a page directory and a few page
+   tables, which would otherwise each cost a trip through palloc
+   and a page of zeroing, and destroying one gives them all back.
+   Instead, pagedir_destroy() zeroes the entries it has to visit
+   anyway and keeps the pages here for the next process:
+
+   - `pd_cache' holds page directories whose kernel half is
+     already a copy of init_page_dir and whose user half is all
+     zeros.
+
+   - `pt_cache' holds all-zero pages, for page tables and for
+     page directories when `pd_cache' is empty.  When it runs
+     low, the pt_refill thread tops it up with freshly zeroed
+     pages at low priority, so that we don't have to zero them
+     while a process waits.
+
+   Both are stacks protected by disabling interrupts, which is
+   cheap for the few instructions it takes to push or pop. */
+#define PD_CACHE_MAX 16                 /* Max cached page directories. */
+#define PT_CACHE_MAX 32                 /* Max cached zero pages. */
+#define PT_CACHE_LOW 8                  /* Refill when fewer than this. */
+#define PT_CACHE_FILL 16                /* Refill up to this many. */
+static void *pd_cache[PD_CACHE_MAX];
+static size_t pd_cache_cnt;
+static void *pt_cache[PT_CACHE_MAX];
+static size_t pt_cache_cnt;
+static struct semaphore refill_sema;    /* Upped to wake pt_refill. */
+static bool refilling;                  /* pt_refill woken but not done? */
+
+static thread_func pt_refill NO_RETURN;
+static void *get_zero_page (void);
+static void put_zero_page (void *);
 
 static uint32_t *active_pd (void);
+#ifdef VM
+static void *pte_get_upage (uint32_t *pd, uint32_t *pde, uint32_t *pt,
+                            uint32_t *pte);
+#endif
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vaddr);
+
+/* A batch of TLB invalidations, opened by pagedir_batch_begin().
+   Only one thread can have a batch open at a time; invalidations
+   by other threads, or for other page directories, take effect
+   immediately as usual. */
+#define BATCH_MAX 32                    /* Beyond this, flush everything. */
+static struct thread *batch_owner;      /* Thread with the batch open. */
+static uint32_t *batch_pd;              /* Page directory being changed. */
+static int batch_depth;                 /* Nesting depth of the batch. */
+static size_t batch_cnt;                /* Pages pending, or > BATCH_MAX. */
+static const void *batch_pages[BATCH_MAX]; /* Pages pending. */
+
+/* Starts the thread that keeps the page table cache filled. */
+void
+pagedir_init (void) 
+{
+  sema_init (&refill_sema, 0);
+  thread_create ("pt_refill", PRI_MIN, pt_refill, NULL);
+}
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -16,17 +82,34 @@ static void invalidate_pagedir (uint32_t *);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  enum intr_level old_level;
+  uint32_t *pd = NULL;
+
+  old_level = intr_disable ();
+  if (pd_cache_cnt > 0)
+    pd = pd_cache[--pd_cache_cnt];
+  intr_set_level (old_level);
+  if (pd != NULL)
+    return pd;
+
+  /* The user half of a zero page is already right. */
+  pd = get_zero_page ();
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    memcpy (pd + pd_no (PHYS_BASE), init_page_dir + pd_no (PHYS_BASE),
+            PGSIZE - pd_no (PHYS_BASE) * sizeof *pd);
   return pd;
 }
 
-/* Destroys page directory PD, freeing all the pages it
-   references. */
+/* Destroys page directory PD, dropping its reference to each
+   page it maps (freeing pages that no other page directory
+   shares), and to each swap slot its swapped-out pages occupy,
+   and freeing its page tables.  PD and its page tables
+   are zeroed along the way and go back to the caches.  With VM,
+   PD must belong to the running process. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
+  enum intr_level old_level;
   uint32_t *pde;
 
   if (pd == NULL)
@@ -40,11 +123,92 @@ pagedir_destroy (uint32_t *pd)
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
+          if (*pte != 0) 
+            {
+#ifdef VM
+              if (*pte & PTE_P)
+                frame_unmap (pte_get_page (*pte), thread_current (),
+                             pte_get_upage (pd, pde, pt, pte));
+              else if (*pte & PTE_SWAP)
+                swap_unref (*pte >> PGBITS);
+#else
+              if (*pte & PTE_P)
+                palloc_page_unref (pte_get_page (*pte));
+#endif
+              *pte = 0;
+            }
+        put_zero_page (pt);
+        *pde = 0;
+      }
+
+  old_level = intr_disable ();
+  if (pd_cache_cnt < PD_CACHE_MAX) 
+    {
+      pd_cache[pd_cache_cnt++] = pd;
+      pd = NULL;
+    }
+  intr_set_level (old_level);
+  if (pd != NULL)
+    palloc_free_page (pd);
+}
+
+/* Creates and returns a new page directory that maps the same
+   user pages as PD, for fork().  Rather than copying the pages,
+   both directories share them: each shared page gains a
+   reference, and writable pages become read-only and
+   copy-on-write in both directories, so that the first write
+   from either side makes a private copy (see pagedir_unshare()).
+   With VM, the new directory belongs to the running process.
+   Returns a null pointer if memory allocation fails. */
+uint32_t *
+pagedir_fork (uint32_t *pd) 
+{
+  uint32_t *new_pd = pagedir_create ();
+  uint32_t *pde;
+
+  if (new_pd == NULL)
+    return NULL;
+
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P) 
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *new_pt = get_zero_page ();
+        size_t i;
+
+        if (new_pt == NULL) 
+          {
+            pagedir_destroy (new_pd);
+            return NULL;
+          }
+        new_pd[pde - pd] = pde_create (new_pt);
+
+        for (i = 0; i < PGSIZE / sizeof *pt; i++)
+          if (pt[i] & PTE_P) 
+            {
+              if (pt[i] & PTE_W)
+                pt[i] = (pt[i] & ~(uint32_t) PTE_W) | PTE_COW;
+              new_pt[i] = pt[i];
+              palloc_page_ref (pte_get_page (pt[i]));
+#ifdef VM
+              frame_share (pte_get_page (pt[i]), thread_current (),
+                           pte_get_upage (pd, pde, pt, &pt[i]));
+#endif
+            }
+#ifdef VM
+          else if (pt[i] & PTE_SWAP) 
+            {
+              /* Both sides read the page back from the same slot. */
+              new_pt[i] = pt[i];
+              swap_ref (pt[i] >> PGBITS);
+            }
+#endif
       }
-  palloc_free_page (pd);
+
+  /* We may have just write-protected pages of the running
+     process. */
+  invalidate_pagedir (pd);
+  return new_pd;
 }
 
 /* Returns the address of the page table entry for virtual
@@ -70,7 +234,7 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
     {
       if (create)
         {
-          pt = palloc_get_page (PAL_ZERO);
+          pt = get_zero_page ();
           if (pt == NULL) 
             return NULL; 
       
@@ -118,6 +282,47 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Maps user virtual page UPAGE in page directory PD, where it
+   must not already be mapped, to page KPAGE, which stays shared
+   with its other users: the mapping takes a reference to KPAGE,
+   and is copy-on-write if WRITABLE is true (see
+   pagedir_unshare()) or read-only otherwise.  Returns true if
+   successful, false if memory allocation failed. */
+bool
+pagedir_share_page (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  uint32_t *pte;
+
+  if (!pagedir_set_page (pd, upage, kpage, false))
+    return false;
+  palloc_page_ref (kpage);
+  if (writable) 
+    {
+      pte = lookup_page (pd, upage, false);
+      *pte |= PTE_COW;
+    }
+  return true;
+}
+
+/* Points the mapping of user virtual page UPAGE in PD, which
+   must be present, at page KPAGE instead, and returns the page
+   it mapped before.  The mapping becomes copy-on-write if it was
+   writable, and keeps its accessed and dirty bits.  The caller
+   is responsible for the references to both pages. */
+void *
+pagedir_remap_cow (uint32_t *pd, void *upage, void *kpage)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  void *old;
+
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  old = pte_get_page (*pte);
+  *pte = (vtop (kpage) | (*pte & PTE_FLAGS & ~(uint32_t) PTE_W)
+          | (*pte & (PTE_W | PTE_COW) ? PTE_COW : 0));
+  invalidate_page (pd, upage);
+  return old;
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -136,6 +341,104 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
     return NULL;
 }
 
+/* Looks up user virtual page UPAGE in PD and returns the kernel
+   virtual address of the frame it maps, or a null pointer if
+   UPAGE is unmapped, read-only, or not a user address.  A
+   copy-on-write page is unshared first.  Used by code that
+   writes into user pages through the kernel's own mapping of
+   physical memory, which bypasses the user PTE's protection. */
+void *
+pagedir_get_writable_page (uint32_t *pd, const void *upage) 
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  if (!is_user_vaddr (upage))
+    return NULL;
+  pte = lookup_page (pd, upage, false);
+  if (pte == NULL || (*pte & PTE_P) == 0)
+    return NULL;
+  if ((*pte & PTE_COW) != 0 && !pagedir_unshare (pd, upage))
+    return NULL;
+  if ((*pte & PTE_W) == 0)
+    return NULL;
+
+  /* The caller will write the page through the kernel's mapping,
+     which the CPU won't notice, so mark it dirty for it. */
+  *pte |= PTE_A | PTE_D;
+  return pte_get_page (*pte);
+}
+
+/* If user virtual page UPAGE is mapped copy-on-write in PD,
+   makes it writable, copying it into a new private frame first
+   if any other page directory still shares the old one.
+   Returns true if successful, false if UPAGE is not
+   copy-on-write or if memory allocation fails.  With VM, PD must
+   be the running process's page directory, which then owns the
+   page's frame, and the unsharing counts as one of its
+   copy-on-write faults whether a page fault or the kernel's own
+   write into the page brought it about. */
+bool
+pagedir_unshare (uint32_t *pd, const void *upage) 
+{
+  uint32_t *pte;
+  void *kpage;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte == NULL || (*pte & (PTE_P | PTE_COW)) != (PTE_P | PTE_COW))
+    return false;
+
+  kpage = pte_get_page (*pte);
+  if (palloc_page_ref_cnt (kpage) > 1) 
+    {
+      /* Still shared: give this directory its own copy.  With
+         VM, the old frame stays pinned while the new one is
+         allocated.  Allocating may evict, and since we hold our
+         own vm_lock, the evictor could otherwise pick the very
+         frame being copied. */
+#ifdef VM
+      void *copy;
+
+      frame_pin (kpage);
+      copy = frame_alloc (0, (void *) upage);
+      if (copy != NULL)
+        memcpy (copy, kpage, PGSIZE);
+      frame_unpin (kpage);
+#else
+      void *copy = palloc_get_page (PAL_USER);
+
+      if (copy != NULL)
+        memcpy (copy, kpage, PGSIZE);
+#endif
+      if (copy == NULL)
+        return false;
+      *pte = (*pte & (PTE_FLAGS & ~PTE_COW)) | vtop (copy) | PTE_W;
+#ifdef VM
+      frame_unmap (kpage, thread_current (), (void *) upage);
+      frame_unpin (copy);
+#else
+      palloc_page_unref (kpage);
+#endif
+    }
+  else
+    {
+      /* Everyone else has let go, so the frame is ours. */
+      *pte = (*pte & ~(uint32_t) PTE_COW) | PTE_W;
+#ifdef VM
+      frame_set_owner (kpage, thread_current (), (void *) upage);
+#endif
+    }
+  invalidate_page (pd, upage);
+#ifdef VM
+  thread_current ()->vmstat.cow_faults++;
+#endif
+  return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
@@ -152,10 +455,49 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
+#ifdef VM
+/* Marks user virtual page UPAGE, which must be present in page
+   directory PD, as swapped out to swap slot SLOT.  Later accesses
+   to the page will fault.  The page remembers whether it was
+   writable; a copy-on-write page counts as writable, since it
+   will come back in a frame of its own. */
+void
+pagedir_set_swapped (uint32_t *pd, void *upage, size_t slot) 
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (slot < (1u << (32 - PGBITS)));
+
+  pte = lookup_page (pd, upage, false);
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  *pte = ((uint32_t) slot << PGBITS) | PTE_SWAP | PTE_U
+         | (*pte & (PTE_W | PTE_COW) ? PTE_W : 0);
+  invalidate_page (pd, upage);
+}
+
+/* Returns true if user virtual page UPAGE in page directory PD
+   is swapped out, storing its swap slot into *SLOT and whether
+   it is writable into *WRITABLE.  Returns false otherwise. */
+bool
+pagedir_get_swapped (uint32_t *pd, const void *upage, size_t *slot,
+                     bool *writable) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+
+  if (pte == NULL || (*pte & (PTE_P | PTE_SWAP)) != PTE_SWAP)
+    return false;
+  *slot = *pte >> PGBITS;
+  *writable = (*pte & PTE_W) != 0;
+  return true;
+}
+#endif
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -180,7 +522,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,11 +551,58 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Starts batching the TLB invalidations that changes to page
+   directory PD's entries require, so that a caller about to
+   change many entries, such as one scanning accessed bits, pays
+   for one flush at pagedir_batch_end() instead of one per entry.
+   Batches may nest.  The caller must not use a changed mapping
+   of PD itself before ending the batch. */
+void
+pagedir_batch_begin (uint32_t *pd) 
+{
+  enum intr_level old_level = intr_disable ();
+  if (batch_owner == NULL) 
+    {
+      batch_owner = thread_current ();
+      batch_pd = pd;
+      batch_cnt = 0;
+    }
+  if (batch_owner == thread_current () && batch_pd == pd)
+    batch_depth++;
+  intr_set_level (old_level);
+}
+
+/* Ends a batch started by pagedir_batch_begin() for PD.  When
+   the outermost batch ends, invalidates the pages it collected
+   one by one, or the whole TLB if there were many of them. */
+void
+pagedir_batch_end (uint32_t *pd) 
+{
+  enum intr_level old_level;
+  size_t i;
+
+  if (batch_owner != thread_current () || batch_pd != pd)
+    return;
+  ASSERT (batch_depth > 0);
+  if (--batch_depth > 0)
+    return;
+
+  old_level = intr_disable ();
+  if (batch_cnt > BATCH_MAX)
+    invalidate_pagedir (pd);
+  else if (active_pd () == pd)
+    for (i = 0; i < batch_cnt; i++)
+      asm volatile ("invlpg (%0)" : : "r" (batch_pages[i]) : "memory");
+  batch_owner = NULL;
+  batch_pd = NULL;
+  intr_set_level (old_level);
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -230,6 +619,18 @@ pagedir_activate (uint32_t *pd)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
+#ifdef VM
+/* Returns the user virtual address that page table entry PTE
+   maps, given that PTE is in page table PT, which page directory
+   entry PDE of page directory PD points to. */
+static void *
+pte_get_upage (uint32_t *pd, uint32_t *pde, uint32_t *pt, uint32_t *pte) 
+{
+  return (void *) (((uintptr_t) (pde - pd) << PDSHIFT)
+                   | ((uintptr_t) (pte - pt) << PTSHIFT));
+}
+#endif
+
 /* Returns the currently active page directory. */
 static uint32_t *
 active_pd (void) 
@@ -261,3 +662,101 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/* Invalidates the TLB entry for virtual address VADDR if PD is
+   the active page directory, or records it to be invalidated at
+   the end of the running thread's batch, if it has one open for
+   PD.  This is much cheaper than invalidate_pagedir(), because
+   it leaves every other TLB entry alone.  See [IA32-v2a]
+   "INVLPG--Invalidate TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vaddr) 
+{
+  if (batch_owner == thread_current () && batch_pd == pd) 
+    {
+      if (batch_cnt < BATCH_MAX)
+        batch_pages[batch_cnt] = vaddr;
+      if (batch_cnt <= BATCH_MAX)
+        batch_cnt++;
+    }
+  else if (active_pd () == pd)
+    asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+}
+
+/* Returns an all-zero kernel page, from the page table cache if
+   possible, or a null pointer if none can be allocated. */
+static void *
+get_zero_page (void) 
+{
+  enum intr_level old_level;
+  void *page = NULL;
+  bool wake = false;
+
+  old_level = intr_disable ();
+  if (pt_cache_cnt > 0)
+    page = pt_cache[--pt_cache_cnt];
+  if (pt_cache_cnt < PT_CACHE_LOW && !refilling) 
+    {
+      refilling = true;
+      wake = true;
+    }
+  intr_set_level (old_level);
+
+  if (wake)
+    sema_up (&refill_sema);
+  if (page == NULL)
+    page = palloc_get_page (PAL_ZERO);
+  return page;
+}
+
+/* Returns PAGE, which must be all zeros, to the page table
+   cache, or frees it if the cache is full. */
+static void
+put_zero_page (void *page) 
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (pt_cache_cnt < PT_CACHE_MAX) 
+    {
+      pt_cache[pt_cache_cnt++] = page;
+      page = NULL;
+    }
+  intr_set_level (old_level);
+  if (page != NULL)
+    palloc_free_page (page);
+}
+
+/* Thread function that refills the page table cache, up to
+   PT_CACHE_FILL pages, each time get_zero_page() finds it
+   running low. */
+static void
+pt_refill (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      sema_down (&refill_sema);
+      for (;;) 
+        {
+          enum intr_level old_level;
+          void *page;
+
+          if (pt_cache_cnt >= PT_CACHE_FILL)
+            break;
+          page = palloc_get_page (PAL_ZERO);
+          if (page == NULL)
+            break;
+
+          old_level = intr_disable ();
+          if (pt_cache_cnt < PT_CACHE_MAX) 
+            {
+              pt_cache[pt_cache_cnt++] = page;
+              page = NULL;
+            }
+          intr_set_level (old_level);
+          if (page != NULL)
+            palloc_free_page (page);
+        }
+      refilling = false;
+    }
+}
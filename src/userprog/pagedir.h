@@ -2,17 +2,29 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+void pagedir_init (void);
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
+uint32_t *pagedir_fork (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_share_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+void *pagedir_remap_cow (uint32_t *pd, void *upage, void *kpage);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
+void *pagedir_get_writable_page (uint32_t *pd, const void *upage);
+bool pagedir_unshare (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+void pagedir_set_swapped (uint32_t *pd, void *upage, size_t slot);
+bool pagedir_get_swapped (uint32_t *pd, const void *upage, size_t *slot,
+                          bool *writable);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+void pagedir_batch_begin (uint32_t *pd);
+void pagedir_batch_end (uint32_t *pd);
 void pagedir_activate (uint32_t *pd);
 
 #endif /* userprog/pagedir.h */
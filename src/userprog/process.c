@@ -11,46 +11,104 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/region.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/syscall.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static thread_func start_fork NO_RETURN;
+static bool load (char *cmd_line, struct region *,
+                  void (**eip) (void), void **esp);
+
+/* What process_execute() passes to start_process().  It and
+   everything else that loading needs only until the new process
+   starts live in one region, freed by start_process(). */
+struct exec_args
+  {
+    struct region *region;      /* Region holding all of this. */
+    char *cmd_line;             /* Copy of the command line. */
+  };
+static struct thread *get_child (tid_t);
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   FILENAME.  FILENAME may be followed by arguments, separated by
+   spaces.  Waits for the new process to load its executable.
+   Returns the new process's thread id, or TID_ERROR if the
+   thread cannot be created or the executable cannot be
+   loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
+  struct region *r;
+  struct exec_args *args;
+  size_t len;
+  char prog_name[16];
+  struct thread *child;
   tid_t tid;
+  void *page;
 
   /* Make a copy of FILE_NAME.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  page = palloc_get_page (0);
+  if (page == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  r = region_init (page);
+  len = strnlen (file_name, PGSIZE - 1);
+  args = region_alloc (r, sizeof *args, 0);
+  if (args != NULL)
+    args->cmd_line = region_alloc (r, len + 1, 1);
+  if (args == NULL || args->cmd_line == NULL)
+    {
+      region_free_all (r);
+      return TID_ERROR;
+    }
+  args->region = r;
+  strlcpy (args->cmd_line, file_name, len + 1);
+
+  /* Name the thread after the program, without its arguments. */
+  file_name += strspn (file_name, " ");
+  strlcpy (prog_name, file_name, sizeof prog_name);
+  prog_name[strcspn (prog_name, " ")] = '\0';
 
   /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  tid = thread_create (prog_name, PRI_DEFAULT, start_process, args);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    {
+      region_free_all (r); 
+      return TID_ERROR;
+    }
+
+  /* Wait for the child to load.  It can't be destroyed before
+     we reap it, so CHILD stays valid. */
+  child = get_child (tid);
+  ASSERT (child != NULL);
+  sema_down (&child->load_done);
+  if (!child->load_success) 
+    {
+      process_wait (tid);
+      return TID_ERROR;
+    }
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *args_)
 {
-  char *file_name = file_name_;
+  struct exec_args *args = args_;
+  struct thread *cur = thread_current ();
   struct intr_frame if_;
   bool success;
 
@@ -59,10 +117,12 @@ start_process (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (args->cmd_line, args->region, &if_.eip, &if_.esp);
 
-  /* If load failed, quit. */
-  palloc_free_page (file_name);
+  /* Tell our parent how it went.  If load failed, quit. */
+  region_free_all (args->region);
+  cur->load_success = success;
+  sema_up (&cur->load_done);
   if (!success) 
     thread_exit ();
 
@@ -76,19 +136,131 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* What a forked child needs from its parent.  Lives on the
+   parent's stack, which is safe because the parent waits for
+   the child to finish copying. */
+struct fork_info
+  {
+    struct thread *parent;      /* Process being forked. */
+    struct intr_frame if_;      /* Parent's user context at fork(). */
+  };
+
+/* Creates a child process that is a copy of the running one,
+   resuming from the user context in IF_ as if fork() had
+   returned 0.  The child shares the parent's user pages
+   copy-on-write and gets its own copies of the parent's open
+   files.  Returns the child's thread id, or TID_ERROR if the
+   child can't be created. */
+tid_t
+process_fork (const struct intr_frame *if_) 
+{
+  struct thread *cur = thread_current ();
+  struct fork_info info;
+  struct thread *child;
+  tid_t tid;
+
+  info.parent = cur;
+  info.if_ = *if_;
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  child = get_child (tid);
+  ASSERT (child != NULL);
+  sema_down (&child->load_done);
+  if (!child->load_success) 
+    {
+      process_wait (tid);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that copies the process described by
+   INFO_ and starts running the copy. */
+static void
+start_fork (void *info_) 
+{
+  struct fork_info *info = info_;
+  struct thread *parent = info->parent;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_ = info->if_;
+  bool success = false;
+
+#ifdef VM
+  /* Keep the evictor out of our parent's page table while we
+     copy it. */
+  lock_acquire (&parent->vm_lock);
+  cur->pagedir = pagedir_fork (parent->pagedir);
+  lock_release (&parent->vm_lock);
+#else
+  cur->pagedir = pagedir_fork (parent->pagedir);
+#endif
+  if (cur->pagedir != NULL) 
+    {
+      process_activate ();
+      lock_acquire (&filesys_lock);
+      cur->executable = file_duplicate (parent->executable);
+      lock_release (&filesys_lock);
+      success = (cur->executable != NULL
+                 && syscall_dup_files (parent));
+#ifdef VM
+      success = success && page_copy_regions (parent);
+#endif
+    }
+
+  /* Tell our parent how it went.  After this, INFO is gone. */
+  cur->load_success = success;
+  sema_up (&cur->load_done);
+  if (!success)
+    thread_exit ();
+
+  /* fork() returns 0 in the child. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Returns the running thread's child with the given TID, or a
+   null pointer if it has none (or has already reaped it). */
+static struct thread *
+get_child (tid_t tid) 
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e)) 
+    {
+      struct thread *t = list_entry (e, struct thread, parent_elem);
+      if (t->tid == tid)
+        return t;
+    }
+  return NULL;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
-  return -1;
+  struct thread *child = get_child (child_tid);
+  int status;
+
+  if (child == NULL)
+    return -1;
+
+  /* Collect the exit status, then let the child finish dying.
+     Removing it from our children makes later waits fail. */
+  sema_down (&child->finished_flag);
+  status = child->ret_status;
+  list_remove (&child->parent_elem);
+  sema_up (&child->allowed_finish);
+  return status;
 }
 
 /* Free the current process's resources. */
@@ -98,6 +270,33 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  if (cur->pagedir != NULL)
+    {
+      printf ("%s: exit(%d)\n", cur->name, cur->ret_status);
+#ifdef VM
+      if (page_exit_stats)
+        page_print_stats ();
+#endif
+    }
+
+#ifdef VM
+  /* Keep the evictor away while we take our address space
+     apart. */
+  lock_acquire (&cur->vm_lock);
+  page_destroy_regions ();
+#endif
+
+  /* Close open files and our executable, which allows writes to
+     it again. */
+  syscall_close_all ();
+  if (cur->executable != NULL) 
+    {
+      lock_acquire (&filesys_lock);
+      file_close (cur->executable);
+      lock_release (&filesys_lock);
+      cur->executable = NULL;
+    }
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -114,6 +313,25 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+#ifdef VM
+  frame_exit (cur);
+  lock_release (&cur->vm_lock);
+#endif
+
+  /* Our children no longer need to wait for us to reap them. */
+  while (!list_empty (&cur->children)) 
+    {
+      struct list_elem *e = list_pop_front (&cur->children);
+      sema_up (&list_entry (e, struct thread, parent_elem)->allowed_finish);
+    }
+
+  /* Report our exit status, then stay around until our parent
+     has collected it (or has exited itself). */
+  if (cur->parent != NULL) 
+    {
+      sema_up (&cur->finished_flag);
+      sema_down (&cur->allowed_finish);
+    }
 }
 
 /* Sets up the CPU for running user code in the current
@@ -196,25 +414,93 @@ struct Elf32_Phdr
 #define PF_R 4          /* Readable. */
 
 static bool setup_stack (void **esp);
+static bool push_arguments (void **esp, char **argv, int argc);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
+/* Executable image cache.
+
+   Before loading an executable, we have to read and check its
+   ELF header and each of its program headers.  For a small
+   program that is most of the work of exec, and it's the same
+   work every time the program runs.  So we keep the validated
+   headers of the most recently run executables here, keyed by
+   inode, and running one of them again skips straight to mapping
+   its segments.
+
+   An image is only good as long as its inode hasn't been written
+   since it was parsed, which we check with the inode's
+   generation.  Each image holds a reference to its inode, so
+   that the inode, and its generation, stay around.  So that
+   reference doesn't keep a removed executable's sectors
+   allocated, removing a file drops any images of removed
+   inodes.  The cache is protected by filesys_lock, which load()
+   holds throughout. */
+
+#define EXEC_CACHE_SIZE 8       /* Maximum number of cached images. */
+
+/* The parsed headers of an executable. */
+struct exec_image
+  {
+    struct list_elem elem;      /* Element in `exec_cache'. */
+    struct inode *inode;        /* The executable. */
+    unsigned generation;        /* INODE's generation when parsed. */
+    struct Elf32_Ehdr ehdr;     /* Executable header. */
+    int seg_cnt;                /* Number of elements in SEGS. */
+    struct Elf32_Phdr segs[];   /* Validated PT_LOAD program headers. */
+  };
+
+/* Cached images, most recently used first. */
+static struct list exec_cache = LIST_INITIALIZER (exec_cache);
+
+static struct exec_image *get_image (struct file *, struct region *);
+static struct exec_image *parse_image (struct file *, struct region *);
+static void free_image (struct exec_image *);
+
+/* Loads an ELF executable into the current thread.  CMD_LINE
+   holds the executable's file name followed by its arguments,
+   separated by spaces; it is modified in the process.
+   Scratch memory comes from region R.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
-bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+static bool
+load (char *cmd_line, struct region *r, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_image *img;
   struct file *file = NULL;
-  off_t file_ofs;
+  char *file_name, *token, *save_ptr;
+  char **argv;
+  int argc, argv_max;
   bool success = false;
   int i;
 
+  /* Break the command line into words.  Words are separated by
+     spaces, so there are at most half as many words as
+     characters, rounded up. */
+  argv_max = (strlen (cmd_line) + 1) / 2;
+  argv = region_alloc (r, argv_max * sizeof *argv, sizeof *argv);
+  if (argv == NULL)
+    return false;
+  argc = 0;
+  for (token = strtok_r (cmd_line, " ", &save_ptr); token != NULL;
+       token = strtok_r (NULL, " ", &save_ptr))
+    {
+      ASSERT (argc < argv_max);
+      argv[argc++] = token;
+    }
+  if (argc == 0)
+    return false;
+  file_name = argv[0];
+
+#ifdef VM
+  lock_acquire (&t->vm_lock);
+#endif
+  lock_acquire (&filesys_lock);
+
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
@@ -228,91 +514,67 @@ load (const char *file_name, void (**eip) (void), void **esp)
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
+  file_deny_write (file);
 
-  /* Read and verify executable header. */
-  if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
-      || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
-      || ehdr.e_type != 2
-      || ehdr.e_machine != 3
-      || ehdr.e_version != 1
-      || ehdr.e_phentsize != sizeof (struct Elf32_Phdr)
-      || ehdr.e_phnum > 1024) 
+  /* Read and verify the executable's headers, or find them in
+     the cache. */
+  img = get_image (file, r);
+  if (img == NULL) 
     {
       printf ("load: %s: error loading executable\n", file_name);
       goto done; 
     }
 
-  /* Read program headers. */
-  file_ofs = ehdr.e_phoff;
-  for (i = 0; i < ehdr.e_phnum; i++) 
+  /* Map the loadable segments. */
+  for (i = 0; i < img->seg_cnt; i++) 
     {
-      struct Elf32_Phdr phdr;
-
-      if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
-      file_seek (file, file_ofs);
-
-      if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
-      file_ofs += sizeof phdr;
-      switch (phdr.p_type) 
+      const struct Elf32_Phdr *phdr = &img->segs[i];
+      bool writable = (phdr->p_flags & PF_W) != 0;
+      uint32_t file_page = phdr->p_offset & ~PGMASK;
+      uint32_t mem_page = phdr->p_vaddr & ~PGMASK;
+      uint32_t page_offset = phdr->p_vaddr & PGMASK;
+      uint32_t read_bytes, zero_bytes;
+      if (phdr->p_filesz > 0)
         {
-        case PT_NULL:
-        case PT_NOTE:
-        case PT_PHDR:
-        case PT_STACK:
-        default:
-          /* Ignore this segment. */
-          break;
-        case PT_DYNAMIC:
-        case PT_INTERP:
-        case PT_SHLIB:
-          goto done;
-        case PT_LOAD:
-          if (validate_segment (&phdr, file)) 
-            {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
-              uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
-              if (phdr.p_filesz > 0)
-                {
-                  /* Normal segment.
-                     Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
-                }
-              else 
-                {
-                  /* Entirely zero.
-                     Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
-                }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
-            }
-          else
-            goto done;
-          break;
+          /* Normal segment.
+             Read initial part from disk and zero the rest. */
+          read_bytes = page_offset + phdr->p_filesz;
+          zero_bytes = (ROUND_UP (page_offset + phdr->p_memsz, PGSIZE)
+                        - read_bytes);
+        }
+      else 
+        {
+          /* Entirely zero.
+             Don't read anything from disk. */
+          read_bytes = 0;
+          zero_bytes = ROUND_UP (page_offset + phdr->p_memsz, PGSIZE);
         }
+      if (!load_segment (file, file_page, (void *) mem_page,
+                         read_bytes, zero_bytes, writable))
+        goto done;
     }
 
   /* Set up stack. */
-  if (!setup_stack (esp))
+  if (!setup_stack (esp) || !push_arguments (esp, argv, argc))
     goto done;
 
   /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
+  *eip = (void (*) (void)) img->ehdr.e_entry;
 
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  /* We arrive here whether the load is successful or not.  On
+     success we keep the executable open, so that writes to it
+     stay denied while it runs. */
+  if (success)
+    t->executable = file;
+  else
+    file_close (file);
+  lock_release (&filesys_lock);
+#ifdef VM
+  lock_release (&t->vm_lock);
+#endif
   return success;
 }
 
@@ -320,6 +582,152 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 static bool install_page (void *upage, void *kpage, bool writable);
 
+/* Returns the image of executable FILE, from the cache if it's
+   there and still current, otherwise parsed afresh and added to
+   the cache, using region R for scratch memory.  Returns a null
+   pointer if FILE isn't a valid executable or if memory
+   allocation fails.  The image belongs to the cache and is only
+   good while filesys_lock is held. */
+static struct exec_image *
+get_image (struct file *file, struct region *r) 
+{
+  struct inode *inode = file_get_inode (file);
+  struct exec_image *img;
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&filesys_lock));
+
+  process_uncache_removed ();
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache);
+       e = list_next (e))
+    {
+      img = list_entry (e, struct exec_image, elem);
+      if (img->inode == inode) 
+        {
+          list_remove (&img->elem);
+          if (img->generation == inode_get_generation (inode)) 
+            {
+              list_push_front (&exec_cache, &img->elem);
+              return img;
+            }
+          free_image (img);
+          break;
+        }
+    }
+
+  img = parse_image (file, r);
+  if (img == NULL)
+    return NULL;
+  img->inode = inode_reopen (inode);
+  img->generation = inode_get_generation (inode);
+  list_push_front (&exec_cache, &img->elem);
+  if (list_size (&exec_cache) > EXEC_CACHE_SIZE)
+    free_image (list_entry (list_pop_back (&exec_cache),
+                            struct exec_image, elem));
+  return img;
+}
+
+/* Reads and verifies the executable header and program headers
+   of FILE, reading the program headers into scratch memory from
+   region R.  Returns a new image holding them, which the caller
+   must fill in the rest of, or a null pointer if FILE isn't a
+   valid executable or if memory allocation fails. */
+static struct exec_image *
+parse_image (struct file *file, struct region *r) 
+{
+  struct Elf32_Ehdr ehdr;
+  struct Elf32_Phdr *phdrs;
+  struct exec_image *img = NULL;
+  struct region_mark mark = region_mark (r);
+  off_t phdrs_size;
+  int i, seg_cnt;
+
+  /* Read and verify executable header. */
+  if (file_read_at (file, &ehdr, sizeof ehdr, 0) != sizeof ehdr
+      || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
+      || ehdr.e_type != 2
+      || ehdr.e_machine != 3
+      || ehdr.e_version != 1
+      || ehdr.e_phentsize != sizeof (struct Elf32_Phdr)
+      || ehdr.e_phnum > 1024
+      || (off_t) ehdr.e_phoff < 0) 
+    return NULL;
+
+  /* Read all the program headers at once. */
+  phdrs_size = ehdr.e_phnum * sizeof *phdrs;
+  phdrs = region_alloc (r, phdrs_size, 0);
+  if (phdrs_size > 0
+      && (phdrs == NULL
+          || file_read_at (file, phdrs, phdrs_size, ehdr.e_phoff) != phdrs_size))
+    goto done;
+
+  /* Keep just the loadable segments, after checking them. */
+  seg_cnt = 0;
+  for (i = 0; i < ehdr.e_phnum; i++) 
+    switch (phdrs[i].p_type) 
+      {
+      case PT_NULL:
+      case PT_NOTE:
+      case PT_PHDR:
+      case PT_STACK:
+      default:
+        /* Ignore this segment. */
+        break;
+      case PT_DYNAMIC:
+      case PT_INTERP:
+      case PT_SHLIB:
+        goto done;
+      case PT_LOAD:
+        if (!validate_segment (&phdrs[i], file))
+          goto done;
+        phdrs[seg_cnt++] = phdrs[i];
+        break;
+      }
+
+  img = malloc (sizeof *img + seg_cnt * sizeof *phdrs);
+  if (img != NULL) 
+    {
+      img->ehdr = ehdr;
+      img->seg_cnt = seg_cnt;
+      memcpy (img->segs, phdrs, seg_cnt * sizeof *phdrs);
+    }
+
+ done:
+  region_release (r, mark);
+  return img;
+}
+
+/* Drops the cached images of executables that have been
+   removed, so that their inodes aren't kept open, and their
+   sectors allocated, on the cache's account.  The caller must
+   hold filesys_lock. */
+void
+process_uncache_removed (void) 
+{
+  struct list_elem *e, *next;
+
+  ASSERT (lock_held_by_current_thread (&filesys_lock));
+
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache); e = next)
+    {
+      struct exec_image *img = list_entry (e, struct exec_image, elem);
+      next = list_next (e);
+      if (inode_is_removed (img->inode)) 
+        {
+          list_remove (&img->elem);
+          free_image (img);
+        }
+    }
+}
+
+/* Drops IMG's inode reference and frees IMG. */
+static void
+free_image (struct exec_image *img) 
+{
+  inode_close (img->inode);
+  free (img);
+}
+
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
 static bool
@@ -377,6 +785,9 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With VM, the segment is only recorded here, and each of its
+   pages is read in by page_load() when it is first touched.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -387,6 +798,10 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  return page_add_region (file, ofs, upage, read_bytes, zero_bytes,
+                          writable);
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -422,6 +837,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -432,18 +848,83 @@ setup_stack (void **esp)
   uint8_t *kpage;
   bool success = false;
 
+#ifdef VM
+  kpage = frame_alloc (PAL_ZERO, ((uint8_t *) PHYS_BASE) - PGSIZE);
+#else
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+#endif
   if (kpage != NULL) 
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
+#ifdef VM
       if (success)
-        *esp = PHYS_BASE;
+        frame_unpin (kpage);
       else
+        frame_free (kpage);
+#else
+      if (!success)
         palloc_free_page (kpage);
+#endif
+      if (success)
+        *esp = PHYS_BASE;
     }
   return success;
 }
 
+/* Pushes the ARGC strings in ARGV onto the user stack whose top
+   is *ESP, followed by the argv[] array that points to them, a
+   pointer to argv[], ARGC, and a fake return address, as the
+   80x86 calling convention expects for main().  Updates *ESP.
+   Returns false if the arguments don't fit in the stack page. */
+static bool
+push_arguments (void **esp, char **argv, int argc) 
+{
+  uint8_t *sp = *esp;
+  uint8_t *bottom = pg_round_down (sp - 1);
+  size_t strings_size = 0;
+  int i;
+
+  /* Make sure everything fits before writing anything. */
+  for (i = 0; i < argc; i++)
+    strings_size += strlen (argv[i]) + 1;
+  if (ROUND_UP (strings_size, sizeof (char *))
+      + (argc + 1) * sizeof (char *) + sizeof (char **) + sizeof (int)
+      + sizeof (void *) > (size_t) (sp - bottom))
+    return false;
+
+  /* Copy the strings, last first, and point argv[] at the
+     copies. */
+  for (i = argc - 1; i >= 0; i--) 
+    {
+      size_t len = strlen (argv[i]) + 1;
+      sp -= len;
+      memcpy (sp, argv[i], len);
+      argv[i] = (char *) sp;
+    }
+
+  /* Word-align, then push argv[argc] (a null pointer sentinel)
+     and argv[argc - 1] through argv[0]. */
+  sp = (uint8_t *) ((uintptr_t) sp & ~(sizeof (char *) - 1));
+  sp -= sizeof (char *);
+  *(char **) sp = NULL;
+  for (i = argc - 1; i >= 0; i--) 
+    {
+      sp -= sizeof (char *);
+      *(char **) sp = argv[i];
+    }
+
+  /* Push argv, argc, and a fake return address. */
+  sp -= sizeof (char **);
+  *(char ***) sp = (char **) (sp + sizeof (char **));
+  sp -= sizeof (int);
+  *(int *) sp = argc;
+  sp -= sizeof (void *);
+  *(void **) sp = NULL;
+
+  *esp = sp;
+  return true;
+}
+
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -1,11 +1,14 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "threads/interrupt.h"
 #include "threads/thread.h"
 
 tid_t process_execute (const char *file_name);
+tid_t process_fork (const struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+void process_uncache_removed (void);
 
 #endif /* userprog/process.h */
@@ -1,20 +1,681 @@
 #include "userprog/syscall.h"
+#include <bitmap.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <vmstat.h>
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* A process's open files are kept in an array indexed by file
+   descriptor, with a bitmap of the descriptors in use, so that
+   finding the file for a descriptor takes constant time and a
+   newly opened file gets the lowest descriptor that is free.
+   Both are created on the first open, FD_TABLE_MIN entries long,
+   and double in size whenever they fill up.  Descriptors 0 and 1
+   belong to the console and are always marked in use. */
+#define FD_TABLE_MIN 16
+
+/* Most pages of a user buffer that a system call keeps pinned in
+   memory at once (see pin_user()).  Bigger buffers are done a
+   piece at a time. */
+#define PIN_PAGES 8
+
+/* Serializes file system operations. */
+struct lock filesys_lock;
 
 static void syscall_handler (struct intr_frame *);
 
+static void sys_exit (int status) NO_RETURN;
+static int sys_open (const char *file);
+static int sys_filesize (int fd);
+static int sys_read (int fd, void *buffer, unsigned size);
+static int sys_write (int fd, const void *buffer, unsigned size);
+static void sys_seek (int fd, unsigned position);
+static unsigned sys_tell (int fd);
+static void sys_close (int fd);
+#ifdef VM
+static int sys_mmap (int fd, void *addr);
+#endif
+static bool sys_vmstat (struct vmstat *);
+
+static size_t pin_user (const void *uaddr, size_t size, bool write);
+static void unpin_user (const void *uaddr, size_t size);
+static void check_user (const void *uaddr, size_t size, bool write);
+static void check_user_string (const char *ustr);
+static char *copy_in_string (const char *ustr);
+static bool resize_fd_table (struct thread *, size_t cnt);
+static int alloc_fd (struct file *);
+static struct file *lookup_fd (int fd);
+
 void
-syscall_init (void) 
+syscall_init (void)
 {
+  lock_init (&filesys_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Fetches the system call number and arguments from the user
+   stack and dispatches to the matching sys_*() function.  Each
+   argument is a 32-bit word; the return value, if any, goes in
+   F's eax member. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+syscall_handler (struct intr_frame *f)
 {
-  printf ("system call!\n");
+  uint32_t *args = f->esp;
+  bool success;
+  char *name;
+
+  check_user (args, sizeof *args, false);
+  switch (args[0])
+    {
+    case SYS_HALT:
+      shutdown_power_off ();
+
+    case SYS_EXIT:
+      check_user (args + 1, sizeof *args, false);
+      sys_exit (args[1]);
+
+    case SYS_EXEC:
+      check_user (args + 1, sizeof *args, false);
+      check_user_string ((const char *) args[1]);
+      f->eax = process_execute ((const char *) args[1]);
+      break;
+
+    case SYS_WAIT:
+      check_user (args + 1, sizeof *args, false);
+      f->eax = process_wait (args[1]);
+      break;
+
+    case SYS_CREATE:
+      check_user (args + 1, 2 * sizeof *args, false);
+      name = copy_in_string ((const char *) args[1]);
+      lock_acquire (&filesys_lock);
+      success = name != NULL && filesys_create (name, args[2]);
+      lock_release (&filesys_lock);
+      free (name);
+      f->eax = success;
+      break;
+
+    case SYS_REMOVE:
+      check_user (args + 1, sizeof *args, false);
+      name = copy_in_string ((const char *) args[1]);
+      lock_acquire (&filesys_lock);
+      success = name != NULL && filesys_remove (name);
+      if (success)
+        process_uncache_removed ();
+      lock_release (&filesys_lock);
+      free (name);
+      f->eax = success;
+      break;
+
+    case SYS_OPEN:
+      check_user (args + 1, sizeof *args, false);
+      f->eax = sys_open ((const char *) args[1]);
+      break;
+
+    case SYS_FILESIZE:
+      check_user (args + 1, sizeof *args, false);
+      f->eax = sys_filesize (args[1]);
+      break;
+
+    case SYS_READ:
+      check_user (args + 1, 3 * sizeof *args, false);
+      f->eax = sys_read (args[1], (void *) args[2], args[3]);
+      break;
+
+    case SYS_WRITE:
+      check_user (args + 1, 3 * sizeof *args, false);
+      f->eax = sys_write (args[1], (const void *) args[2], args[3]);
+      break;
+
+    case SYS_SEEK:
+      check_user (args + 1, 2 * sizeof *args, false);
+      sys_seek (args[1], args[2]);
+      break;
+
+    case SYS_TELL:
+      check_user (args + 1, sizeof *args, false);
+      f->eax = sys_tell (args[1]);
+      break;
+
+    case SYS_CLOSE:
+      check_user (args + 1, sizeof *args, false);
+      sys_close (args[1]);
+      break;
+
+    case SYS_FORK:
+      f->eax = process_fork (f);
+      break;
+
+#ifdef VM
+    case SYS_MMAP:
+      check_user (args + 1, 2 * sizeof *args, false);
+      f->eax = sys_mmap (args[1], (void *) args[2]);
+      break;
+
+    case SYS_MUNMAP:
+      check_user (args + 1, sizeof *args, false);
+      page_munmap (args[1]);
+      break;
+#endif
+
+    case SYS_VMSTAT:
+      check_user (args + 1, sizeof *args, false);
+      f->eax = sys_vmstat ((struct vmstat *) args[1]);
+      break;
+
+    default:
+      sys_exit (-1);
+    }
+}
+
+/* Terminates the current process with exit status STATUS. */
+static void
+sys_exit (int status)
+{
+  thread_current ()->ret_status = status;
   thread_exit ();
 }
+
+/* Opens FILE and returns a new file descriptor for it, or -1 if
+   it can't be opened. */
+static int
+sys_open (const char *file)
+{
+  char *name = copy_in_string (file);
+  struct file *f;
+  int fd;
+
+  if (name == NULL)
+    return -1;
+  lock_acquire (&filesys_lock);
+  f = filesys_open (name);
+  lock_release (&filesys_lock);
+  free (name);
+  if (f == NULL)
+    return -1;
+
+  fd = alloc_fd (f);
+  if (fd < 0)
+    {
+      lock_acquire (&filesys_lock);
+      file_close (f);
+      lock_release (&filesys_lock);
+    }
+  return fd;
+}
+
+/* Returns the size, in bytes, of the file open as FD. */
+static int
+sys_filesize (int fd)
+{
+  struct file *file = lookup_fd (fd);
+  int size;
+
+  if (file == NULL)
+    return -1;
+  lock_acquire (&filesys_lock);
+  size = file_length (file);
+  lock_release (&filesys_lock);
+  return size;
+}
+
+/* Reads SIZE bytes from FD into BUFFER.  Returns the number of
+   bytes actually read, or -1 if FD is not open for reading.
+   File data is read straight into the user's pages, a few pinned
+   pages at a time. */
+static int
+sys_read (int fd, void *buffer, unsigned size)
+{
+  uint8_t *dst = buffer;
+  struct file *file;
+  unsigned bytes_read = 0;
+
+  if (fd == STDIN_FILENO)
+    {
+      /* Keystrokes can be a long time coming, so gather them
+         before pinning the pages they go to. */
+      uint8_t keys[64];
+
+      while (bytes_read < size)
+        {
+          size_t cnt = size - bytes_read;
+          size_t i;
+
+          if (cnt > sizeof keys)
+            cnt = sizeof keys;
+          for (i = 0; i < cnt; i++)
+            keys[i] = input_getc ();
+          cnt = pin_user (dst + bytes_read, cnt, true);
+          memcpy (dst + bytes_read, keys, cnt);
+          unpin_user (dst + bytes_read, cnt);
+          bytes_read += cnt;
+        }
+      return size;
+    }
+
+  file = lookup_fd (fd);
+  if (file == NULL)
+    return -1;
+  while (bytes_read < size)
+    {
+      size_t cnt = pin_user (dst + bytes_read, size - bytes_read, true);
+      off_t n;
+
+      lock_acquire (&filesys_lock);
+      n = file_read_user (file, thread_current ()->pagedir,
+                          dst + bytes_read, cnt);
+      lock_release (&filesys_lock);
+      unpin_user (dst + bytes_read, cnt);
+      bytes_read += n;
+      if ((size_t) n < cnt)
+        break;
+    }
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER to FD.  Returns the number of
+   bytes actually written, or -1 if FD is not open for
+   writing. */
+static int
+sys_write (int fd, const void *buffer, unsigned size)
+{
+  const uint8_t *src = buffer;
+  struct file *file = NULL;
+  unsigned bytes_written = 0;
+
+  if (fd != STDOUT_FILENO)
+    {
+      file = lookup_fd (fd);
+      if (file == NULL)
+        return -1;
+    }
+  while (bytes_written < size)
+    {
+      size_t cnt = pin_user (src + bytes_written, size - bytes_written,
+                             false);
+      size_t n;
+
+      if (file == NULL)
+        {
+          /* Write the console in big chunks, so that output from
+             different processes isn't interleaved mid-line. */
+          for (n = 0; n < cnt; n += 256)
+            putbuf ((const char *) src + bytes_written + n,
+                    cnt - n < 256 ? cnt - n : 256);
+          n = cnt;
+        }
+      else
+        {
+          lock_acquire (&filesys_lock);
+          n = file_write (file, src + bytes_written, cnt);
+          lock_release (&filesys_lock);
+        }
+      unpin_user (src + bytes_written, cnt);
+      bytes_written += n;
+      if (n < cnt)
+        break;
+    }
+  return bytes_written;
+}
+
+/* Changes the next byte to be read or written in FD to
+   POSITION. */
+static void
+sys_seek (int fd, unsigned position)
+{
+  struct file *file = lookup_fd (fd);
+
+  if (file != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      file_seek (file, position);
+      lock_release (&filesys_lock);
+    }
+}
+
+/* Returns the position of the next byte to be read or written
+   in FD. */
+static unsigned
+sys_tell (int fd)
+{
+  struct file *file = lookup_fd (fd);
+  unsigned position;
+
+  if (file == NULL)
+    return 0;
+  lock_acquire (&filesys_lock);
+  position = file_tell (file);
+  lock_release (&filesys_lock);
+  return position;
+}
+
+/* Closes FD, making it free for reuse. */
+static void
+sys_close (int fd)
+{
+  struct thread *cur = thread_current ();
+  struct file *file = lookup_fd (fd);
+
+  if (file != NULL)
+    {
+      cur->files[fd] = NULL;
+      bitmap_reset (cur->fd_map, fd);
+      lock_acquire (&filesys_lock);
+      file_close (file);
+      lock_release (&filesys_lock);
+    }
+}
+
+#ifdef VM
+/* Maps the file open as FD into memory at ADDR and returns a
+   mapping id for it, or -1 if it can't be mapped.  The mapping
+   has its own handle on the file, so it survives closing FD. */
+static int
+sys_mmap (int fd, void *addr)
+{
+  struct file *file = lookup_fd (fd);
+  int mapid;
+
+  if (file == NULL)
+    return -1;
+  lock_acquire (&filesys_lock);
+  file = file_reopen (file);
+  lock_release (&filesys_lock);
+  if (file == NULL)
+    return -1;
+
+  mapid = page_mmap (file, addr);
+  if (mapid == -1)
+    {
+      lock_acquire (&filesys_lock);
+      file_close (file);
+      lock_release (&filesys_lock);
+    }
+  return mapid;
+}
+#endif
+
+/* Copies the running process's paging statistics to STATS.
+   Returns true if successful, false if the kernel doesn't keep
+   them. */
+static bool
+sys_vmstat (struct vmstat *stats)
+{
+#ifdef VM
+  struct vmstat s;
+
+  /* Take the snapshot first, so that it doesn't count the fault
+     that brings in STATS. */
+  page_get_stats (&s);
+  pin_user (stats, sizeof *stats, true);
+  *stats = s;
+  unpin_user (stats, sizeof *stats);
+  return true;
+#else
+  (void) stats;
+  return false;
+#endif
+}
+
+/* Closes all of the running process's open files and frees its
+   descriptor table. */
+void
+syscall_close_all (void)
+{
+  struct thread *cur = thread_current ();
+  size_t fd;
+
+  if (cur->fd_map == NULL)
+    return;
+  for (fd = 0; fd < bitmap_size (cur->fd_map); fd++)
+    sys_close (fd);
+  free (cur->files);
+  bitmap_destroy (cur->fd_map);
+  cur->files = NULL;
+  cur->fd_map = NULL;
+}
+
+/* Gives the running process a copy of each of PARENT's open
+   files, under the same descriptors.  Returns true if
+   successful, false if memory allocation fails. */
+bool
+syscall_dup_files (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  bool success = true;
+  size_t fd;
+
+  if (parent->fd_map == NULL)
+    return true;
+  if (!resize_fd_table (cur, bitmap_size (parent->fd_map)))
+    return false;
+
+  lock_acquire (&filesys_lock);
+  for (fd = 0; fd < bitmap_size (parent->fd_map); fd++)
+    if (parent->files[fd] != NULL)
+      {
+        cur->files[fd] = file_duplicate (parent->files[fd]);
+        if (cur->files[fd] == NULL)
+          {
+            success = false;
+            break;
+          }
+        bitmap_mark (cur->fd_map, fd);
+      }
+  lock_release (&filesys_lock);
+
+  return success;
+}
+
+/* Grows thread T's descriptor table to CNT entries, which must
+   be at least as many as it has now, creating it if T has none.
+   Returns true if successful, false if memory allocation
+   fails. */
+static bool
+resize_fd_table (struct thread *t, size_t cnt)
+{
+  size_t old_cnt = t->fd_map != NULL ? bitmap_size (t->fd_map) : 0;
+  struct file **files;
+  struct bitmap *fd_map;
+  size_t fd;
+
+  ASSERT (cnt >= old_cnt);
+
+  fd_map = bitmap_create (cnt);
+  if (fd_map == NULL)
+    return false;
+  files = realloc (t->files, cnt * sizeof *files);
+  if (files == NULL)
+    {
+      bitmap_destroy (fd_map);
+      return false;
+    }
+
+  for (fd = 0; fd < old_cnt; fd++)
+    bitmap_set (fd_map, fd, bitmap_test (t->fd_map, fd));
+  for (fd = old_cnt; fd < cnt; fd++)
+    files[fd] = NULL;
+  bitmap_mark (fd_map, STDIN_FILENO);
+  bitmap_mark (fd_map, STDOUT_FILENO);
+
+  bitmap_destroy (t->fd_map);
+  t->fd_map = fd_map;
+  t->files = files;
+  return true;
+}
+
+/* Gives FILE the running process's lowest free file descriptor
+   and returns it, or returns -1 if memory allocation fails. */
+static int
+alloc_fd (struct file *file)
+{
+  struct thread *cur = thread_current ();
+  size_t fd = BITMAP_ERROR;
+
+  if (cur->fd_map != NULL)
+    fd = bitmap_scan_and_flip (cur->fd_map, 0, 1, false);
+  if (fd == BITMAP_ERROR)
+    {
+      size_t cnt = cur->fd_map != NULL ? 2 * bitmap_size (cur->fd_map)
+                                       : FD_TABLE_MIN;
+      if (!resize_fd_table (cur, cnt))
+        return -1;
+      fd = bitmap_scan_and_flip (cur->fd_map, 0, 1, false);
+      ASSERT (fd != BITMAP_ERROR);
+    }
+  cur->files[fd] = file;
+  return fd;
+}
+
+/* Returns the running process's open file with descriptor FD,
+   or a null pointer if there is none. */
+static struct file *
+lookup_fd (int fd)
+{
+  struct thread *cur = thread_current ();
+
+  if (fd < 0 || cur->fd_map == NULL
+      || (size_t) fd >= bitmap_size (cur->fd_map))
+    return NULL;
+  return cur->files[fd];
+}
+
+/* Keeps as much of the SIZE bytes of user memory starting at
+   UADDR as fits in PIN_PAGES pages in memory until unpin_user(),
+   so that a system call can use it while holding the file system
+   lock, and returns the number of bytes pinned.  Terminates the
+   process with exit status -1 unless they are all mapped, and
+   writable as well if WRITE is true.  Without VM, nothing is
+   ever evicted, so the memory only needs to be checked. */
+static size_t
+pin_user (const void *uaddr, size_t size, bool write)
+{
+  size_t max = PIN_PAGES * PGSIZE - pg_ofs (uaddr);
+
+  if (size > max)
+    size = max;
+#ifdef VM
+  if (size > 0)
+    {
+      const uint8_t *start = uaddr;
+      const uint8_t *end = start + size;
+      const uint8_t *page;
+
+      if (end < start || !is_user_vaddr (end - 1))
+        sys_exit (-1);
+      for (page = pg_round_down (start); page < end; page += PGSIZE)
+        if (!page_pin (page, write))
+          {
+            if (page > start)
+              unpin_user (start, page - start);
+            sys_exit (-1);
+          }
+    }
+#else
+  check_user (uaddr, size, write);
+#endif
+  return size;
+}
+
+/* Undoes pin_user() for the SIZE bytes starting at UADDR. */
+static void
+unpin_user (const void *uaddr, size_t size)
+{
+#ifdef VM
+  const uint8_t *start = uaddr;
+  const uint8_t *page;
+
+  for (page = pg_round_down (start); page < start + size; page += PGSIZE)
+    page_unpin (page);
+#else
+  (void) uaddr;
+  (void) size;
+#endif
+}
+
+/* Terminates the process with exit status -1 unless all SIZE
+   bytes starting at user virtual address UADDR are mapped, and
+   writable as well if WRITE is true.  With VM, pages that haven't
+   been brought in yet are loaded now. */
+static void
+check_user (const void *uaddr, size_t size, bool write)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const uint8_t *start = uaddr;
+  const uint8_t *end = start + size;
+  const uint8_t *page;
+
+  if (size == 0)
+    return;
+  if (end < start || !is_user_vaddr (end - 1))
+    sys_exit (-1);
+  for (page = pg_round_down (start); page < end; page += PGSIZE)
+    {
+#ifdef VM
+      bool locked = page_lock ();
+      bool ok = (page_load (page, write)
+                 && (write
+                     ? pagedir_get_writable_page (pd, page) != NULL
+                     : pagedir_get_page (pd, page) != NULL));
+      page_unlock (locked);
+      if (!ok)
+        sys_exit (-1);
+#else
+      if (write
+          ? pagedir_get_writable_page (pd, page) == NULL
+          : pagedir_get_page (pd, page) == NULL)
+        sys_exit (-1);
+#endif
+    }
+}
+
+/* Terminates the process with exit status -1 unless the
+   null-terminated string at user virtual address USTR is
+   entirely mapped. */
+static void
+check_user_string (const char *ustr)
+{
+  const char *p = ustr;
+
+  /* Check each page once, then scan it up to its end. */
+  for (;;)
+    {
+      check_user (p, 1, false);
+      do
+        if (*p++ == '\0')
+          return;
+      while (pg_ofs (p) != 0);
+    }
+}
+
+/* Returns a copy, obtained from malloc(), of the null-terminated
+   string at user virtual address USTR, so that it can be used
+   while holding the file system lock, or a null pointer if
+   memory is short.  Terminates the process with exit status -1
+   unless the string is entirely mapped. */
+static char *
+copy_in_string (const char *ustr)
+{
+  size_t size;
+  char *copy;
+
+  check_user_string (ustr);
+  size = strlen (ustr) + 1;
+  copy = malloc (size);
+  if (copy != NULL)
+    memcpy (copy, ustr, size);
+  return copy;
+}
@@ -1,6 +1,16 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct thread;
+
+/* Serializes file system operations. */
+extern struct lock filesys_lock;
+
 void syscall_init (void);
+void syscall_close_all (void);
+bool syscall_dup_files (struct thread *);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,792 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   There is a `struct frame' for each page in the user pool,
+   recording which process maps it and at what address.  When
+   the user pool runs dry, frame_alloc() evicts a frame that is
+   in use, choosing it with the clock algorithm: a hand sweeps
+   around the table, giving each frame accessed since the hand
+   last passed a second chance by clearing its accessed bit, and
+   takes the first frame that hasn't been accessed.  The first
+   sweeps only take clean frames, which can be dropped without
+   writing them anywhere.  A frame that does go to
+   swap takes along the unaccessed frames its owner maps just
+   after it, so that they are written to swap in one burst.  The
+   evictor holds frame_lock only to choose and unmap its victim,
+   not while it writes the victim out (see evict()).
+
+   Besides its owner, a frame records the other processes that
+   map it, its sharers, such as a child that shares its parent's
+   pages after fork().  When the owner unmaps the frame, the
+   first sharer takes its place, so the owner is always a process
+   that maps the frame.  The evictor takes a shared frame away
+   from all of its mappers at once (see page_evict_shared()).
+   Executable text that processes share (see vm/page.c) and pages
+   merged by ksmd (see vm/ksm.c) are shared the same way.  Frames
+   without an owner, such as the page of zeros that page.c maps
+   for untouched memory, aren't tracked and are never evicted,
+   and neither are pinned frames, which are still being filled in
+   or are in use by a system call (see page_pin()).
+
+   To look at and change a page table, the evictor needs the
+   vm_lock of the process that owns it, which it only tries to
+   acquire: a frame that a process busy with its own memory maps
+   is skipped.  A process may evict its own frames, as long as it
+   holds its vm_lock.
+
+   Each process also has a quota of frames, set by its page fault
+   frequency: a process that faults often gets a bigger quota,
+   and one that rarely faults a smaller one.  The clock first
+   looks for victims among processes that have more frames than
+   their quotas, so that one process that needs a lot of memory
+   replaces its own pages instead of thrashing everyone else's.
+   When the quotas that processes ask for add up to more than the
+   user pool, a process that wants still more is suspended for a
+   while, with its quota at the minimum, so that the others can
+   make progress.
+
+   Page directories drop their references to user frames through
+   frame_unmap(), and callers that can't use a frame they were
+   given free it with frame_free(), so that a frame loses its
+   owner exactly when it is freed.
+
+   Lock order: a thread's vm_lock, then frame_lock.  A thread
+   unmaps all of its frames before it dies, and that takes
+   frame_lock, so a mapper seen while holding frame_lock is still
+   alive. */
+
+/* A process that maps a user frame besides its owner. */
+struct frame_map
+  {
+    struct thread *t;           /* The process. */
+    void *upage;                /* User virtual address in T. */
+    struct frame_map *next;     /* Next sharer, or null. */
+  };
+
+/* A user frame. */
+struct frame
+  {
+    struct thread *owner;       /* Process that maps it, or null. */
+    void *upage;                /* User virtual address in OWNER. */
+    struct frame_map *sharers;  /* Other processes that map it. */
+    unsigned pin_cnt;           /* Never evict while nonzero. */
+    bool merged;                /* Read-only page merged by ksmd? */
+  };
+
+/* Most processes that the evictor takes a frame away from. */
+#define EVICT_MAPS 8
+
+static struct frame *frames;    /* One per user pool page. */
+static size_t frame_cnt;        /* Number of elements in FRAMES. */
+static uint8_t *frame_base;     /* Page that frames[0] describes. */
+static size_t hand;             /* Clock hand, an index into FRAMES. */
+static size_t quota_total;      /* Sum of live processes' quotas. */
+static size_t active_cnt;       /* Processes with quotas, not suspended. */
+static struct lock frame_lock;  /* Protects all of the above. */
+
+/* Page fault frequency.  A process's fault rate is measured over
+   windows of at least PFF_WINDOW timer ticks.  A rate of at least
+   PFF_HIGH faults per PFF_WINDOW ticks grows its quota by a
+   quarter, and one of at most PFF_LOW shrinks it by an eighth. */
+#define PFF_WINDOW (TIMER_FREQ / 10)
+#define PFF_HIGH 8
+#define PFF_LOW 1
+#define QUOTA_MIN 16                    /* Smallest quota. */
+#define QUOTA_INIT 64                   /* Quota of a new process. */
+#define SUSPEND_MAX (2 * TIMER_FREQ)    /* Longest suspension. */
+
+/* A frame chosen for eviction. */
+struct victim
+  {
+    struct thread *locked[EVICT_MAPS]; /* Mappers whose vm_locks we hold. */
+    size_t lock_cnt;                   /* Number of elements in LOCKED. */
+    struct page_out out;               /* Pages still to write out. */
+  };
+
+static void *evict (void *upage);
+static bool try_evict (struct frame *, void *kpage, bool dirty_ok,
+                       bool over_quota, struct victim *);
+static size_t get_mappers (struct frame *, struct thread *mappers[],
+                           void *upages[]);
+static bool lock_mapper (struct thread *, struct victim *);
+static bool evict_cluster (struct thread *owner, struct frame *,
+                           struct page_out *);
+static void *claim_frame (void *kpage, void *upage);
+static void set_owner (struct frame *, struct thread *, void *upage);
+static void forget_mappers (struct frame *);
+static void set_quota (struct thread *, size_t quota);
+static struct frame *page_to_frame (void *kpage);
+
+/* Initializes the frame table. */
+void
+frame_init (void) 
+{
+  frame_base = palloc_user_pool (&frame_cnt);
+  frames = calloc (frame_cnt, sizeof *frames);
+  if (frames == NULL && frame_cnt > 0)
+    PANIC ("can't allocate frame table");
+  lock_init (&frame_lock);
+}
+
+/* Obtains a user frame, evicting one that is in use if none is
+   free, to be mapped at UPAGE by the running process, and
+   returns its kernel virtual address.  FLAGS are as for
+   palloc_get_page(), except that PAL_USER is implied.  Returns a
+   null pointer if no frame can be had, unless PAL_ASSERT is set.
+
+   The new frame is pinned, so that it can't be evicted while the
+   caller fills it in.  The caller should unpin it with
+   frame_unpin() once it has been mapped. */
+void *
+frame_alloc (enum palloc_flags flags, void *upage) 
+{
+  void *kpage = palloc_get_page (PAL_USER | (flags & PAL_ZERO));
+
+  if (kpage != NULL) 
+    {
+      lock_acquire (&frame_lock);
+      claim_frame (kpage, upage);
+      lock_release (&frame_lock);
+    }
+  else 
+    {
+      kpage = evict (upage);
+      if (kpage != NULL && (flags & PAL_ZERO))
+        memset (kpage, 0, PGSIZE);
+    }
+
+  if (kpage == NULL && (flags & PAL_ASSERT))
+    PANIC ("frame_alloc: out of frames");
+  return kpage;
+}
+
+/* Like frame_alloc(), but returns a null pointer instead of
+   evicting a frame if none is free, whatever FLAGS says. */
+void *
+frame_try_alloc (enum palloc_flags flags, void *upage) 
+{
+  void *kpage = palloc_get_page (PAL_USER | (flags & PAL_ZERO));
+
+  lock_acquire (&frame_lock);
+  kpage = claim_frame (kpage, upage);
+  lock_release (&frame_lock);
+  return kpage;
+}
+
+/* Frees frame KPAGE, obtained from frame_alloc() but not
+   mapped, for a caller that can't use it after all. */
+void
+frame_free (void *kpage) 
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = page_to_frame (kpage);
+  forget_mappers (f);
+  f->pin_cnt = 0;
+  palloc_free_page (kpage);
+  lock_release (&frame_lock);
+}
+
+/* Records that T maps user frame KPAGE at UPAGE besides the
+   processes that already do, for a page directory that has just
+   taken a reference to it.  Frames without an owner aren't
+   tracked.  If memory is short, the mapping isn't recorded
+   either, which only keeps the frame from being evicted. */
+void
+frame_share (void *kpage, struct thread *t, void *upage) 
+{
+  struct frame_map *m = malloc (sizeof *m);
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = page_to_frame (kpage);
+  if (m != NULL && f->owner != NULL) 
+    {
+      m->t = t;
+      m->upage = upage;
+      m->next = f->sharers;
+      f->sharers = m;
+      m = NULL;
+    }
+  lock_release (&frame_lock);
+  free (m);
+}
+
+/* Drops a reference to user frame KPAGE that no mapping accounts
+   for, freeing the frame if it was the last one. */
+void
+frame_unref (void *kpage) 
+{
+  lock_acquire (&frame_lock);
+  if (palloc_page_unref (kpage))
+    forget_mappers (page_to_frame (kpage));
+  lock_release (&frame_lock);
+}
+
+/* Drops the reference to user frame KPAGE of T's page directory,
+   which no longer maps it at UPAGE.  If T owned the frame, the
+   first of its sharers takes over.  Returns true if that was the
+   frame's last reference and it was freed. */
+bool
+frame_unmap (void *kpage, struct thread *t, void *upage) 
+{
+  struct frame *f;
+  bool freed;
+
+  lock_acquire (&frame_lock);
+  f = page_to_frame (kpage);
+  if (f->owner == t && f->upage == upage) 
+    {
+      struct frame_map *m = f->sharers;
+
+      if (m != NULL) 
+        {
+          f->sharers = m->next;
+          set_owner (f, m->t, m->upage);
+          free (m);
+        }
+      else
+        set_owner (f, NULL, NULL);
+    }
+  else 
+    {
+      struct frame_map **mp;
+
+      for (mp = &f->sharers; *mp != NULL; mp = &(*mp)->next)
+        if ((*mp)->t == t && (*mp)->upage == upage) 
+          {
+            struct frame_map *m = *mp;
+            *mp = m->next;
+            free (m);
+            break;
+          }
+    }
+  freed = palloc_page_unref (kpage);
+  if (freed)
+    forget_mappers (f);
+  lock_release (&frame_lock);
+  return freed;
+}
+
+/* Keeps frame KPAGE, which the running process maps, from being
+   evicted until a matching call to frame_unpin().  The caller
+   must hold the running process's vm_lock. */
+void
+frame_pin (void *kpage) 
+{
+  lock_acquire (&frame_lock);
+  page_to_frame (kpage)->pin_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Undoes a call to frame_pin(), or the pinning of frame KPAGE by
+   frame_alloc(), making the frame eligible for eviction again
+   once nobody else has it pinned. */
+void
+frame_unpin (void *kpage) 
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = page_to_frame (kpage);
+  ASSERT (f->pin_cnt > 0);
+  f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Records that frame KPAGE is mapped at UPAGE by OWNER alone,
+   and isn't merged.  A null OWNER means that the frame isn't
+   tracked and may not be evicted. */
+void
+frame_set_owner (void *kpage, struct thread *owner, void *upage) 
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = page_to_frame (kpage);
+  forget_mappers (f);
+  set_owner (f, owner, upage);
+  lock_release (&frame_lock);
+}
+
+/* Marks user frame KPAGE, which every process that maps it now
+   maps read-only, as merged by ksmd, so that more pages with the
+   same contents may be mapped to it.  The mark goes away when the
+   frame becomes writable again or is freed. */
+void
+frame_set_merged (void *kpage) 
+{
+  lock_acquire (&frame_lock);
+  page_to_frame (kpage)->merged = true;
+  lock_release (&frame_lock);
+}
+
+/* If user frame KPAGE is still merged, takes a reference to it,
+   which keeps it merged, and returns true.  The caller should
+   hand the reference to a new mapping with frame_share() or drop
+   it with frame_unref().  Returns false otherwise. */
+bool
+frame_ref_merged (void *kpage) 
+{
+  struct frame *f;
+  bool merged;
+
+  lock_acquire (&frame_lock);
+  f = page_to_frame (kpage);
+  merged = f->merged;
+  if (merged)
+    palloc_page_ref (kpage);
+  lock_release (&frame_lock);
+  return merged;
+}
+
+/* Returns true if user frame KPAGE is merged. */
+bool
+frame_is_merged (void *kpage) 
+{
+  return page_to_frame (kpage)->merged;
+}
+
+/* Returns true if user frame KPAGE is pinned.  A caller that
+   holds the vm_lock of every process that maps KPAGE can rely on
+   a false result, since pinning takes that lock. */
+bool
+frame_is_pinned (void *kpage) 
+{
+  bool pinned;
+
+  lock_acquire (&frame_lock);
+  pinned = page_to_frame (kpage)->pin_cnt > 0;
+  lock_release (&frame_lock);
+  return pinned;
+}
+
+/* If user frame KPAGE belongs to a single process that isn't
+   busy with its memory, and the process still maps it, acquires
+   the process's vm_lock and returns the process, storing the
+   frame's user address into *UPAGE.  The caller must release the
+   lock when done.  Otherwise returns a null pointer.  Frames are
+   skipped for the same reasons as in try_evict(). */
+struct thread *
+frame_lock_owner (void *kpage, void **upage) 
+{
+  struct thread *owner;
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = page_to_frame (kpage);
+  owner = f->owner;
+  if (owner == NULL || owner == thread_current () || f->pin_cnt > 0
+      || palloc_page_ref_cnt (kpage) != 1
+      || !lock_try_acquire (&owner->vm_lock))
+    owner = NULL;
+  else if (owner->pagedir == NULL
+           || pagedir_get_page (owner->pagedir, f->upage) != kpage) 
+    {
+      lock_release (&owner->vm_lock);
+      owner = NULL;
+    }
+  else
+    *upage = f->upage;
+  lock_release (&frame_lock);
+  return owner;
+}
+
+/* Gives up T's quota, for when T exits, after its page directory
+   has unmapped all of its frames. */
+void
+frame_exit (struct thread *t) 
+{
+  lock_acquire (&frame_lock);
+  ASSERT (t->frame_cnt == 0);
+  if (t->frame_quota > 0) 
+    {
+      set_quota (t, 0);
+      active_cnt--;
+    }
+  lock_release (&frame_lock);
+}
+
+/* Records a page fault by the running process, which must not
+   hold any locks, and adjusts its quota at the end of each
+   measuring window.  If the process needs a bigger quota than
+   the user pool has room for, and other processes are running,
+   suspends it for a while. */
+void
+frame_note_fault (void) 
+{
+  struct thread *t = thread_current ();
+  int64_t now = timer_ticks ();
+  int64_t elapsed;
+  size_t want = 0;
+  size_t old_quota = 0;
+
+  lock_acquire (&frame_lock);
+  if (t->frame_quota == 0)
+    {
+      set_quota (t, QUOTA_INIT);
+      active_cnt++;
+      t->window_start = now;
+    }
+  t->fault_cnt++;
+  t->window_faults++;
+  elapsed = now - t->window_start;
+  if (elapsed >= PFF_WINDOW) 
+    {
+      size_t quota = t->frame_quota;
+
+      if (t->window_faults * PFF_WINDOW >= PFF_HIGH * elapsed)
+        quota += quota / 4;
+      else if (t->window_faults * PFF_WINDOW <= PFF_LOW * elapsed)
+        quota -= quota / 8;
+      if (quota < QUOTA_MIN)
+        quota = QUOTA_MIN;
+
+      if (quota > t->frame_quota
+          && quota_total - t->frame_quota + quota > frame_cnt
+          && active_cnt > 1) 
+        {
+          /* Give the others our frames while we wait. */
+          want = quota;
+          old_quota = t->frame_quota;
+          quota = QUOTA_MIN;
+          active_cnt--;
+        }
+      set_quota (t, quota);
+      t->window_faults = 0;
+      t->window_start = now;
+    }
+  lock_release (&frame_lock);
+
+  if (want > 0) 
+    {
+      int64_t start = timer_ticks ();
+      bool room;
+
+      for (;;) 
+        {
+          timer_sleep (PFF_WINDOW);
+          lock_acquire (&frame_lock);
+          room = quota_total - t->frame_quota + want <= frame_cnt;
+          if (room || timer_elapsed (start) >= SUSPEND_MAX)
+            break;
+          lock_release (&frame_lock);
+        }
+
+      /* Resume with the quota we wanted if it fits now, or else
+         with the one we had, rather than the minimum, which would
+         make our frames the first to be evicted. */
+      set_quota (t, room ? want : old_quota);
+      active_cnt++;
+      t->window_start = timer_ticks ();
+      t->window_faults = 0;
+      lock_release (&frame_lock);
+    }
+}
+
+/* Runs the clock hand around the frame table, looking for a
+   frame to evict in four phases of two sweeps each: first a
+   clean frame of a process over its quota, then any frame of
+   such a process, then a clean frame of anyone, and then any
+   frame at all.  Returns the evicted frame, claimed for UPAGE in
+   the running process as by frame_alloc(), or a null pointer if
+   every frame is busy.
+
+   The victim is chosen, unmapped, and claimed while holding
+   frame_lock, but it is written out, to swap or to a mapped
+   file, only after the lock is released, so that other
+   processes can get frames while we wait for the disk.  The
+   vm_locks of the victim's mappers stay held until the write is
+   done, so that none of them can bring the page back in from
+   somewhere it hasn't reached yet. */
+static void *
+evict (void *upage) 
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  struct victim v;
+  void *kpage = NULL;
+  size_t i;
+
+  lock_acquire (&frame_lock);
+
+  /* Clearing accessed bits in our own page directory would
+     otherwise flush a TLB entry each. */
+  if (pd != NULL)
+    pagedir_batch_begin (pd);
+  for (i = 0; i < 8 * frame_cnt && kpage == NULL; i++) 
+    {
+      void *page = frame_base + hand * PGSIZE;
+      struct frame *f = &frames[hand];
+      size_t phase = i / (2 * frame_cnt);
+
+      hand = (hand + 1) % frame_cnt;
+      if (try_evict (f, page, phase % 2 == 1, phase < 2, &v))
+        kpage = page;
+    }
+  if (pd != NULL)
+    pagedir_batch_end (pd);
+  if (kpage != NULL)
+    claim_frame (kpage, upage);
+  lock_release (&frame_lock);
+
+  if (kpage == NULL)
+    return NULL;
+  page_write_out (&v.out);
+  while (v.lock_cnt > 0)
+    lock_release (&v.locked[--v.lock_cnt]->vm_lock);
+
+  /* Free the rest of the victim's cluster. */
+  if (v.out.cnt > 1) 
+    {
+      lock_acquire (&frame_lock);
+      for (i = 1; i < v.out.cnt; i++) 
+        {
+          page_to_frame (v.out.kpages[i])->pin_cnt = 0;
+          palloc_free_page (v.out.kpages[i]);
+        }
+      lock_release (&frame_lock);
+    }
+  return kpage;
+}
+
+/* Evicts frame F, whose kernel virtual address is KPAGE, if it
+   can be and it hasn't been accessed recently, clearing its
+   accessed bit otherwise.  Passes over frames that would have to
+   be written out, to swap or to a mapped file, unless DIRTY_OK
+   is true, and frames of processes within their quotas if
+   OVER_QUOTA is true.  Returns true if F was evicted, in which
+   case *V says what remains to be done once frame_lock is
+   released.  The caller must hold frame_lock. */
+static bool
+try_evict (struct frame *f, void *kpage, bool dirty_ok, bool over_quota,
+           struct victim *v) 
+{
+  struct thread *mappers[EVICT_MAPS];
+  void *upages[EVICT_MAPS];
+  size_t map_cnt;
+  bool accessed = false;
+  bool evicted = false;
+  size_t i;
+
+  if (f->owner == NULL || f->pin_cnt > 0)
+    return false;
+  if (over_quota && f->owner->frame_cnt <= f->owner->frame_quota)
+    return false;
+
+  /* A reference that no mapping accounts for belongs to someone
+     we can't take the frame away from. */
+  map_cnt = get_mappers (f, mappers, upages);
+  if (map_cnt == 0 || palloc_page_ref_cnt (kpage) != map_cnt)
+    return false;
+
+  v->lock_cnt = 0;
+  for (i = 0; i < map_cnt; i++) 
+    {
+      struct thread *t = mappers[i];
+
+      if (!lock_mapper (t, v) || t->pagedir == NULL
+          || pagedir_get_page (t->pagedir, upages[i]) != kpage)
+        goto done;
+    }
+
+  /* A frame that any of its mappers has touched gets a second
+     chance from all of them. */
+  for (i = 0; i < map_cnt; i++)
+    if (pagedir_is_accessed (mappers[i]->pagedir, upages[i])) 
+      {
+        pagedir_set_accessed (mappers[i]->pagedir, upages[i], false);
+        accessed = true;
+      }
+  if (accessed)
+    goto done;
+
+  if (map_cnt == 1)
+    evicted = ((dirty_ok || page_is_clean (f->owner, f->upage))
+               && evict_cluster (f->owner, f, &v->out));
+  else
+    evicted = page_evict_shared (mappers, upages, map_cnt, dirty_ok,
+                                 &v->out);
+
+ done:
+  if (evicted) 
+    {
+      /* Keep the reference that the frame's next user gets. */
+      for (i = 1; i < map_cnt; i++)
+        palloc_page_unref (kpage);
+      forget_mappers (f);
+    }
+  else
+    while (v->lock_cnt > 0)
+      lock_release (&v->locked[--v->lock_cnt]->vm_lock);
+  return evicted;
+}
+
+/* Stores the processes that map frame F into MAPPERS, owner
+   first, and the user virtual addresses where they map it into
+   UPAGES.  Returns the number of mappers, or 0 if there are more
+   than EVICT_MAPS of them. */
+static size_t
+get_mappers (struct frame *f, struct thread *mappers[], void *upages[]) 
+{
+  struct frame_map *m;
+  size_t cnt = 1;
+
+  mappers[0] = f->owner;
+  upages[0] = f->upage;
+  for (m = f->sharers; m != NULL; m = m->next) 
+    {
+      if (cnt >= EVICT_MAPS)
+        return 0;
+      mappers[cnt] = m->t;
+      upages[cnt] = m->upage;
+      cnt++;
+    }
+  return cnt;
+}
+
+/* Makes sure that the running thread holds T's vm_lock, for
+   evicting a frame that T maps.  The running thread's own lock
+   must already be held.  Other threads' locks are only tried,
+   and those acquired are added to V's, for the caller to
+   release.  Returns true if successful, false if T is busy. */
+static bool
+lock_mapper (struct thread *t, struct victim *v) 
+{
+  size_t i;
+
+  if (t == thread_current ())
+    return lock_held_by_current_thread (&t->vm_lock);
+  for (i = 0; i < v->lock_cnt; i++)
+    if (v->locked[i] == t)
+      return true;
+  if (!lock_try_acquire (&t->vm_lock))
+    return false;
+  v->locked[v->lock_cnt++] = t;
+  return true;
+}
+
+/* Evicts frame F, which OWNER maps at F->upage, along with as
+   many as SWAP_CLUSTER - 1 of the frames that OWNER maps at the
+   pages just after it, if F has to go to swap and those can go
+   with it: evictable, unaccessed, and also bound for swap.  The
+   extra frames are disowned and pinned, and should be freed once
+   *OUT has been written out.  The caller must hold frame_lock
+   and OWNER's vm_lock.  Returns true if F was evicted. */
+static bool
+evict_cluster (struct thread *owner, struct frame *f, struct page_out *out) 
+{
+  uint8_t *upage = f->upage;
+  void *kpages[SWAP_CLUSTER];
+  size_t cnt = 1;
+  size_t evicted, i;
+
+  if (page_needs_swap (owner, upage))
+    for (; cnt < SWAP_CLUSTER; cnt++) 
+      {
+        uint8_t *next = upage + cnt * PGSIZE;
+        struct frame *nf;
+
+        if (!is_user_vaddr (next))
+          break;
+        kpages[cnt] = pagedir_get_page (owner->pagedir, next);
+        if (kpages[cnt] == NULL)
+          break;
+        nf = page_to_frame (kpages[cnt]);
+        if (nf->owner != owner || nf->upage != next || nf->pin_cnt > 0
+            || nf->sharers != NULL
+            || palloc_page_ref_cnt (kpages[cnt]) != 1
+            || pagedir_is_accessed (owner->pagedir, next)
+            || !page_needs_swap (owner, next))
+          break;
+      }
+
+  evicted = page_evict (owner, upage, cnt, out);
+  for (i = 1; i < evicted; i++) 
+    {
+      struct frame *nf = page_to_frame (kpages[i]);
+      set_owner (nf, NULL, NULL);
+      nf->pin_cnt = 1;
+    }
+  return evicted > 0;
+}
+
+/* Records frame KPAGE, if it isn't null, as pinned and mapped at
+   UPAGE by the running process, and returns it.  The caller must
+   hold frame_lock. */
+static void *
+claim_frame (void *kpage, void *upage) 
+{
+  if (kpage != NULL) 
+    {
+      struct frame *f = page_to_frame (kpage);
+
+      ASSERT (f->owner == NULL && f->sharers == NULL && !f->merged);
+      ASSERT (f->pin_cnt == 0);
+      set_owner (f, thread_current (), upage);
+      f->pin_cnt = 1;
+    }
+  return kpage;
+}
+
+/* Records that frame F is mapped at UPAGE by OWNER, which may be
+   null, keeping the owners' frame counts.  The caller must hold
+   frame_lock. */
+static void
+set_owner (struct frame *f, struct thread *owner, void *upage) 
+{
+  if (f->owner != NULL) 
+    {
+      ASSERT (f->owner->frame_cnt > 0);
+      f->owner->frame_cnt--;
+    }
+  f->owner = owner;
+  f->upage = upage;
+  if (owner != NULL)
+    owner->frame_cnt++;
+}
+
+/* Forgets all of the processes that map frame F, which is no
+   longer merged either.  The caller must hold frame_lock. */
+static void
+forget_mappers (struct frame *f) 
+{
+  while (f->sharers != NULL) 
+    {
+      struct frame_map *m = f->sharers;
+      f->sharers = m->next;
+      free (m);
+    }
+  set_owner (f, NULL, NULL);
+  f->merged = false;
+}
+
+/* Sets T's quota to QUOTA, keeping the total.  The caller must
+   hold frame_lock. */
+static void
+set_quota (struct thread *t, size_t quota) 
+{
+  quota_total = quota_total - t->frame_quota + quota;
+  t->frame_quota = quota;
+}
+
+/* Returns the frame table entry for user pool page KPAGE. */
+static struct frame *
+page_to_frame (void *kpage) 
+{
+  size_t idx = pg_no (kpage) - pg_no (frame_base);
+
+  ASSERT (idx < frame_cnt);
+  return &frames[idx];
+}
@@ -0,0 +1,27 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include "threads/palloc.h"
+
+struct thread;
+
+void frame_init (void);
+void *frame_alloc (enum palloc_flags, void *upage);
+void *frame_try_alloc (enum palloc_flags, void *upage);
+void frame_free (void *kpage);
+void frame_share (void *kpage, struct thread *, void *upage);
+void frame_unref (void *kpage);
+bool frame_unmap (void *kpage, struct thread *, void *upage);
+void frame_pin (void *kpage);
+void frame_unpin (void *kpage);
+void frame_set_owner (void *kpage, struct thread *, void *upage);
+void frame_set_merged (void *kpage);
+bool frame_ref_merged (void *kpage);
+bool frame_is_merged (void *kpage);
+bool frame_is_pinned (void *kpage);
+struct thread *frame_lock_owner (void *kpage, void **upage);
+void frame_exit (struct thread *);
+void frame_note_fault (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,323 @@
+#include "vm/ksm.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Same-page merging.
+
+   Processes running the same program often end up with private
+   pages whose contents are identical, such as initialized data
+   that was never changed after it was written.  The ksmd thread
+   walks the user pool at low priority looking for such pages
+   and maps all of their copies, copy-on-write, to one frame, so
+   that the others can be freed.  The first write to a merged
+   page gets a private copy again through the usual copy-on-write
+   fault (see pagedir_unshare()).
+
+   ksmd hashes each frame that belongs to a single process.  A
+   frame is only a merge candidate if its hash hasn't changed
+   since the previous pass, so that pages that are being written
+   aren't merged just to be copied again.  A stable frame is
+   looked up by its hash first in `merged_pages', the frames
+   merged so far, and then in `candidates', the stable frames
+   seen earlier in this pass.  Finding a match in `candidates'
+   promotes that frame to a merged page.  The tables are keyed by
+   the hashes they recorded, not by the pages' current contents,
+   which may change under them, so a match only means that the
+   pages are worth comparing: the full comparison is done with
+   interrupts off right before the page table entry is switched,
+   so that the owner can't change the page in between.
+
+   The tables hold no references.  A merged frame is an ordinary
+   copy-on-write frame, shared through the frame table's reverse
+   map like a page after fork(), and can be evicted like one.  The
+   frame table remembers that it is merged until it becomes
+   writable again or is freed (see frame_set_merged()), and
+   entries for frames that are no longer merged are dropped at
+   the end of each pass.  Only ksmd touches these tables, so they
+   need no lock. */
+
+/* Pages examined between naps, and the length of a nap. */
+#define SCAN_BATCH 64
+#define SCAN_NAP 1
+
+/* Ticks to rest between passes over the user pool. */
+#define PASS_NAP TIMER_FREQ
+
+/* A page in `merged_pages' or `candidates'. */
+struct ksm_page
+  {
+    struct hash_elem hash_elem; /* Element in the table. */
+    unsigned checksum;          /* hash_bytes() of the contents. */
+    void *kpage;                /* The frame. */
+    struct thread *owner;       /* Candidates only: owner. */
+    void *upage;                /* Candidates only: user address. */
+    struct list_elem list_elem; /* For dropping merged pages. */
+  };
+
+static struct hash merged_pages;        /* Merged frames. */
+static struct hash candidates;          /* Stable frames this pass. */
+static unsigned *checksums;             /* Last hash of each frame. */
+static uint8_t *pool_base;              /* First user pool page. */
+static size_t pool_cnt;                 /* Pages in the user pool. */
+
+static thread_func ksmd;
+static void scan_page (size_t idx);
+static struct thread *lock_twin (struct ksm_page *, struct thread *owner);
+static void promote (struct thread *owner, void *upage, void *kpage);
+static bool merge (struct thread *owner, void *upage, void *kpage,
+                   void *merged);
+static void end_pass (void);
+static hash_hash_func ksm_page_hash;
+static hash_less_func ksm_page_less;
+static hash_action_func free_ksm_page;
+
+/* Starts the same-page merging thread. */
+void
+ksm_init (void)
+{
+  pool_base = palloc_user_pool (&pool_cnt);
+  checksums = calloc (pool_cnt, sizeof *checksums);
+  if ((checksums == NULL && pool_cnt > 0)
+      || !hash_init (&merged_pages, ksm_page_hash, ksm_page_less, NULL)
+      || !hash_init (&candidates, ksm_page_hash, ksm_page_less, NULL))
+    PANIC ("can't allocate same-page merging tables");
+  thread_create ("ksmd", PRI_MIN, ksmd, NULL);
+}
+
+/* Same-page merging thread. */
+static void
+ksmd (void *aux UNUSED)
+{
+  for (;;)
+    {
+      size_t i;
+
+      for (i = 0; i < pool_cnt; i++)
+        {
+          scan_page (i);
+          if (i % SCAN_BATCH == SCAN_BATCH - 1)
+            timer_sleep (SCAN_NAP);
+        }
+      end_pass ();
+      timer_sleep (PASS_NAP);
+    }
+}
+
+/* Examines user pool page IDX, merging it with an identical page
+   if it is stable and there is one. */
+static void
+scan_page (size_t idx)
+{
+  void *kpage = pool_base + idx * PGSIZE;
+  struct ksm_page key, *kp;
+  struct hash_elem *e;
+  struct thread *owner;
+  void *upage;
+  bool stable;
+
+  owner = frame_lock_owner (kpage, &upage);
+  if (owner == NULL)
+    return;
+
+  /* Executable text is shared through its file already. */
+  if (page_is_shared (owner, upage))
+    goto done;
+
+  key.checksum = hash_bytes (kpage, PGSIZE);
+  key.kpage = kpage;
+  stable = key.checksum == checksums[idx];
+  checksums[idx] = key.checksum;
+  if (!stable)
+    goto done;
+
+  /* Share a page that is already merged, or forget it if it
+     isn't any more. */
+  e = hash_find (&merged_pages, &key.hash_elem);
+  if (e != NULL)
+    {
+      kp = hash_entry (e, struct ksm_page, hash_elem);
+      if (kp->kpage == kpage)
+        goto done;
+      if (frame_ref_merged (kp->kpage))
+        {
+          merge (owner, upage, kpage, kp->kpage);
+          goto done;
+        }
+      hash_delete (&merged_pages, e);
+      free (kp);
+    }
+
+  /* Merge with a twin seen earlier in this pass, making its frame
+     the merged page. */
+  e = hash_find (&candidates, &key.hash_elem);
+  if (e != NULL)
+    {
+      struct thread *twin_owner;
+
+      kp = hash_entry (e, struct ksm_page, hash_elem);
+      hash_delete (&candidates, e);
+      twin_owner = lock_twin (kp, owner);
+      if (twin_owner != NULL)
+        {
+          promote (twin_owner, kp->upage, kp->kpage);
+          kp->owner = NULL;
+          kp->upage = NULL;
+          hash_insert (&merged_pages, &kp->hash_elem);
+          if (frame_ref_merged (kp->kpage))
+            merge (owner, upage, kpage, kp->kpage);
+        }
+      else
+        free (kp);
+      if (twin_owner != NULL && twin_owner != owner)
+        lock_release (&twin_owner->vm_lock);
+      goto done;
+    }
+
+  /* Remember this page for the rest of the pass. */
+  kp = malloc (sizeof *kp);
+  if (kp != NULL)
+    {
+      *kp = key;
+      kp->owner = owner;
+      kp->upage = upage;
+      hash_insert (&candidates, &kp->hash_elem);
+    }
+
+ done:
+  lock_release (&owner->vm_lock);
+}
+
+/* Checks that candidate KP is still a private, unpinned frame
+   mapped by its owner at the same address, and returns its
+   owner, with its vm_lock acquired unless it is OWNER, whose
+   lock the caller already holds.  Returns a null pointer
+   otherwise.  A pinned frame may be the target of a system
+   call's kernel writes, which must not land in a merged page. */
+static struct thread *
+lock_twin (struct ksm_page *kp, struct thread *owner)
+{
+  struct thread *twin_owner;
+  void *twin_upage;
+
+  if (kp->owner == owner)
+    return (palloc_page_ref_cnt (kp->kpage) == 1
+            && !frame_is_pinned (kp->kpage)
+            && pagedir_get_page (owner->pagedir, kp->upage) == kp->kpage
+            ? owner : NULL);
+
+  twin_owner = frame_lock_owner (kp->kpage, &twin_upage);
+  if (twin_owner != NULL
+      && (twin_owner != kp->owner || twin_upage != kp->upage))
+    {
+      lock_release (&twin_owner->vm_lock);
+      twin_owner = NULL;
+    }
+  return twin_owner;
+}
+
+/* Makes KPAGE, the frame of OWNER's page UPAGE, a merged page,
+   by making UPAGE copy-on-write.  The caller must hold OWNER's
+   vm_lock. */
+static void
+promote (struct thread *owner, void *upage, void *kpage)
+{
+  pagedir_remap_cow (owner->pagedir, upage, kpage);
+  frame_set_merged (kpage);
+}
+
+/* Maps UPAGE in OWNER, now mapped to its own frame KPAGE, to
+   merged frame MERGED instead, copy-on-write, if the two still
+   have the same contents, and frees KPAGE.  The caller must hold
+   OWNER's vm_lock and a reference to MERGED from
+   frame_ref_merged(), which goes to the new mapping or is
+   dropped.  Returns true if successful, false if the contents
+   differ. */
+static bool
+merge (struct thread *owner, void *upage, void *kpage, void *merged)
+{
+  enum intr_level old_level;
+  bool same;
+
+  /* With interrupts off, OWNER can't write to KPAGE between the
+     comparison and the switch, after which KPAGE is unmapped and
+     MERGED is read-only. */
+  old_level = intr_disable ();
+  same = !memcmp (kpage, merged, PGSIZE);
+  if (same)
+    pagedir_remap_cow (owner->pagedir, upage, merged);
+  intr_set_level (old_level);
+
+  if (same)
+    {
+      frame_share (merged, owner, upage);
+      frame_unmap (kpage, owner, upage);
+    }
+  else
+    frame_unref (merged);
+  return same;
+}
+
+/* Ends a pass over the user pool: forgets this pass's
+   candidates, and the merged pages that aren't merged any
+   more. */
+static void
+end_pass (void)
+{
+  struct list unused;
+  struct hash_iterator i;
+
+  hash_clear (&candidates, free_ksm_page);
+
+  list_init (&unused);
+  hash_first (&i, &merged_pages);
+  while (hash_next (&i))
+    {
+      struct ksm_page *kp = hash_entry (hash_cur (&i), struct ksm_page,
+                                        hash_elem);
+      if (!frame_is_merged (kp->kpage))
+        list_push_back (&unused, &kp->list_elem);
+    }
+  while (!list_empty (&unused))
+    {
+      struct ksm_page *kp = list_entry (list_pop_front (&unused),
+                                        struct ksm_page, list_elem);
+      hash_delete (&merged_pages, &kp->hash_elem);
+      free (kp);
+    }
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+ksm_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_entry (e, struct ksm_page, hash_elem)->checksum;
+}
+
+/* Returns true if page A precedes page B, by hash. */
+static bool
+ksm_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+               void *aux UNUSED)
+{
+  const struct ksm_page *a = hash_entry (a_, struct ksm_page, hash_elem);
+  const struct ksm_page *b = hash_entry (b_, struct ksm_page, hash_elem);
+
+  return a->checksum < b->checksum;
+}
+
+/* Frees page E, for hash_clear(). */
+static void
+free_ksm_page (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct ksm_page, hash_elem));
+}
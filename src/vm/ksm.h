@@ -0,0 +1,6 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+void ksm_init (void);
+
+#endif /* vm/ksm.h */
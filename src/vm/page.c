@@ -0,0 +1,1157 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   The hardware page directory only describes pages that are
+   present.  Each process also keeps an interval tree of `struct
+   vm_region's, which say what belongs at the addresses that are
+   not present yet: which file, at which offset, and how much of
+   each page is zero fill.  The tree finds the region of a
+   faulting address, or any region overlapping a new one, in
+   O(log n) time, and costs the same however few of a region's
+   pages have been touched.  load() records an executable's
+   segments here instead of reading them, and page_fault() calls
+   page_load() to fill in a page the first time it is touched, so
+   a program only pays to read the pages it actually uses.  To
+   save faults, page_load() also fills in the neighbours of the
+   faulting page that are cheap to have, and reads ahead of
+   sequential scans.
+
+   A zero-fill page that is read before it is written maps
+   `zero_page', a single frame of zeros shared by everyone, and
+   gets a private frame only on its first write, as a
+   copy-on-write page.  Untouched or read-mostly BSS therefore
+   costs no memory.
+
+   When memory runs short, the frame table
+   (see vm/frame.c) can take a page back with page_evict().  A
+   page that is still as it was read in is simply dropped, and
+   the next touch brings it in again the same way; any other
+   page goes to swap (see vm/swap.c), and comes back from there.
+   Pages go to swap in clusters of neighbours that occupy
+   adjacent slots, and bringing one back in prefetches the rest
+   of its cluster, since pages evicted together tend to be needed
+   together.
+
+   mmap() adds a region backed by the mapped file.  Its dirty
+   pages go back to the file instead of to swap, when they are
+   evicted and when the mapping goes away, so a program can read
+   and patch a file in place without copying it through a
+   buffer.
+
+   Read-only pages that come from a file, such as the code of an
+   executable, are also shared among all the processes that map
+   them: the first process to touch one reads it into a frame and
+   enters it in `shared_pages', and later ones just map the same
+   frame.  Running N copies of a program thus costs about as much
+   memory, and as much disk I/O, as running one.  Such a frame is
+   never dirty, so the evictor can always just drop it, from all
+   of the processes that map it at once; that also drops its
+   entry, and the next process to touch the page reads it in
+   again. */
+
+/* A read-only file page mapped by one or more processes. */
+struct shared_page
+  {
+    struct hash_elem hash_elem; /* Element in `shared_pages'. */
+    block_sector_t sector;      /* Inode sector of the file. */
+    off_t ofs;                  /* Offset of the page in the file. */
+    void *kpage;                /* The shared frame. */
+  };
+
+/* Shared pages, keyed by SECTOR and OFS.  Each page directory
+   that maps a shared frame holds one palloc reference to it; the
+   table holds none, and an entry is removed when the last of
+   those references is dropped by release_shared(), or when the
+   frame is evicted (see forget_shared()).  Protected by
+   shared_lock, which nests outside filesys_lock and frame_lock. */
+static struct hash shared_pages;
+static struct lock shared_lock;
+
+/* A user frame of zeros, which page.c holds a reference to
+   forever so that it never goes away or gets evicted. */
+static void *zero_page;
+
+static hash_hash_func shared_page_hash;
+static hash_less_func shared_page_less;
+
+/* Print each process's paging statistics when it exits?
+   Controlled by kernel command-line option "-vmstat". */
+bool page_exit_stats;
+
+/* How far load_region_page() may go to bring in a page. */
+enum load_mode
+  {
+    LOAD_DEMAND,                /* Evict and read as needed. */
+    LOAD_AHEAD,                 /* Read, but only into free frames. */
+    LOAD_AROUND                 /* Only what needs no disk I/O. */
+  };
+
+/* Pages in the aligned block that fault_around() fills in. */
+#define FAULT_AROUND 8
+
+/* Bounds of a region's read-ahead window, in pages. */
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 32
+
+static uint8_t *read_page (struct vm_region *, uint8_t *upage,
+                           size_t page_read_bytes, enum load_mode);
+static bool load_page (uint8_t *upage, bool write);
+static bool load_region_page (struct vm_region *, uint8_t *upage,
+                              enum load_mode, bool write);
+static void fault_around (struct vm_region *, uint8_t *upage);
+static void read_ahead (struct vm_region *, uint8_t *upage);
+static bool swap_in (uint8_t *upage, size_t slot, bool writable);
+static void prefetch_swapped (uint8_t *upage, size_t slot);
+static bool swap_in_frame (uint8_t *upage, size_t slot, bool writable,
+                           void *kpage);
+static bool is_shared (const struct vm_region *, const void *upage);
+static bool load_shared (struct vm_region *, uint8_t *upage,
+                         size_t page_read_bytes, enum load_mode);
+static void release_shared (struct vm_region *);
+static bool forget_shared (struct thread *, const void *upage);
+static struct vm_region *add_region (struct file *, off_t ofs, void *upage,
+                                     uint32_t read_bytes,
+                                     uint32_t zero_bytes, bool writable);
+static void unmap_region (struct vm_region *);
+static void write_back (struct vm_region *, const uint8_t *upage,
+                        const void *buffer, size_t size);
+static void count_fault (enum load_mode, uint64_t *counter);
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  hash_init (&shared_pages, shared_page_hash, shared_page_less, NULL);
+  lock_init (&shared_lock);
+  zero_page = palloc_get_page (PAL_USER | PAL_ZERO | PAL_ASSERT);
+}
+
+/* Records a region of the running process's address space that
+   starts at UPAGE and spans READ_BYTES + ZERO_BYTES bytes, which
+   must be a multiple of PGSIZE.  Its first READ_BYTES bytes come
+   from FILE starting at offset OFS and the rest are zeroed.
+   Returns true if successful, false if memory allocation fails
+   or the region overlaps an existing one. */
+bool
+page_add_region (struct file *file, off_t ofs, void *upage,
+                 uint32_t read_bytes, uint32_t zero_bytes, bool writable)
+{
+  return add_region (file, ofs, upage, read_bytes, zero_bytes,
+                     writable) != NULL;
+}
+
+/* Returns the region of thread T's address space that contains
+   user virtual address UADDR, or a null pointer if there is
+   none. */
+struct vm_region *
+page_find_region (struct thread *t, const void *uaddr)
+{
+  struct itree_elem *e = itree_lookup (&t->regions, (uintptr_t) uaddr);
+
+  return e != NULL ? itree_entry (e, struct vm_region, elem) : NULL;
+}
+
+/* Maps all of FILE into the running process's address space
+   starting at ADDR, as a region whose pages are read in on first
+   touch and written back when dirty.  On success, the mapping
+   takes over FILE and its id is returned.  Returns -1, leaving
+   FILE alone, if FILE is empty or ADDR isn't page-aligned, or if
+   the mapping would overlap user pages that are already in use
+   or the kernel. */
+int
+page_mmap (struct file *file, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct vm_region *r = NULL;
+  struct itree_elem *e;
+  uint8_t *upage;
+  size_t size;
+  off_t length;
+  int mapid = 1;
+  bool locked;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || !is_user_vaddr (addr))
+    return -1;
+  lock_acquire (&filesys_lock);
+  length = file_length (file);
+  lock_release (&filesys_lock);
+  size = ROUND_UP ((size_t) length, PGSIZE);
+  if (length == 0 || size > (size_t) ((uint8_t *) PHYS_BASE - (uint8_t *) addr))
+    return -1;
+
+  locked = page_lock ();
+
+  /* Pages outside any region, such as the stack, are in use if
+     they are present or swapped out.  page_add_region() takes
+     care of overlapping regions. */
+  for (upage = addr; upage < (uint8_t *) addr + size; upage += PGSIZE)
+    {
+      size_t slot;
+      bool writable;
+
+      if (pagedir_get_page (cur->pagedir, upage) != NULL
+          || pagedir_get_swapped (cur->pagedir, upage, &slot, &writable))
+        goto done;
+    }
+
+  for (e = itree_first (&cur->regions); e != NULL; e = itree_next (e))
+    {
+      struct vm_region *other = itree_entry (e, struct vm_region, elem);
+      if (other->mapid >= mapid)
+        mapid = other->mapid + 1;
+    }
+  r = add_region (file, 0, addr, length, size - length, true);
+  if (r != NULL)
+    r->mapid = mapid;
+
+ done:
+  page_unlock (locked);
+  return r != NULL ? mapid : -1;
+}
+
+/* Removes the running process's mapping with id MAPID, if it
+   has one, writing its dirty pages back to its file. */
+void
+page_munmap (int mapid)
+{
+  struct thread *cur = thread_current ();
+  struct itree_elem *e;
+  bool locked;
+
+  if (mapid <= 0)
+    return;
+
+  locked = page_lock ();
+  for (e = itree_first (&cur->regions); e != NULL; e = itree_next (e))
+    {
+      struct vm_region *r = itree_entry (e, struct vm_region, elem);
+      if (r->mapid == mapid)
+        {
+          itree_remove (&cur->regions, &r->elem);
+          unmap_region (r);
+          free (r);
+          break;
+        }
+    }
+  page_unlock (locked);
+}
+
+/* Gives the running process a copy of each of PARENT's regions,
+   for fork().  Regions backed by PARENT's executable are backed
+   by the running process's own executable instead, and mappings
+   get their own handles on their files.  Returns true if
+   successful, false if memory allocation fails. */
+bool
+page_copy_regions (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct itree_elem *e;
+
+  for (e = itree_first (&parent->regions); e != NULL; e = itree_next (e))
+    {
+      struct vm_region *pr = itree_entry (e, struct vm_region, elem);
+      struct vm_region *r = malloc (sizeof *r);
+
+      if (r == NULL)
+        return false;
+      *r = *pr;
+      if (r->mapid != 0)
+        {
+          lock_acquire (&filesys_lock);
+          r->file = file_reopen (pr->file);
+          lock_release (&filesys_lock);
+          if (r->file == NULL)
+            {
+              free (r);
+              return false;
+            }
+        }
+      else if (r->file != NULL)
+        {
+          ASSERT (r->file == parent->executable);
+          r->file = cur->executable;
+        }
+      itree_insert (&cur->regions, &r->elem,
+                    (uintptr_t) r->start, (uintptr_t) r->end);
+    }
+  return true;
+}
+
+/* Forgets all of the running process's regions, unmapping their
+   shared pages and writing back and closing its mappings.
+   Private pages that were brought in stay mapped in its page
+   directory, which frees them.  Must be called while the
+   executable is still open. */
+void
+page_destroy_regions (void)
+{
+  struct thread *cur = thread_current ();
+
+  while (!itree_empty (&cur->regions))
+    {
+      struct itree_elem *e = itree_first (&cur->regions);
+      struct vm_region *r = itree_entry (e, struct vm_region, elem);
+
+      itree_remove (&cur->regions, e);
+      if (r->mapid != 0)
+        unmap_region (r);
+      else if (!r->writable && r->file != NULL && cur->pagedir != NULL)
+        release_shared (r);
+      free (r);
+    }
+}
+
+/* Acquires the running process's vm_lock, which keeps the frame
+   evictor away from its page tables, unless it already holds it.
+   Returns true if it acquired the lock, in which case the caller
+   must release it by passing true to page_unlock(). */
+bool
+page_lock (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (lock_held_by_current_thread (&cur->vm_lock))
+    return false;
+  lock_acquire (&cur->vm_lock);
+  return true;
+}
+
+/* Releases the running process's vm_lock if LOCKED is true. */
+void
+page_unlock (bool locked)
+{
+  if (locked)
+    lock_release (&thread_current ()->vm_lock);
+}
+
+/* Brings in the page that contains user virtual address UADDR in
+   the running process, as page_load() does, and pins its frame,
+   so that a system call can use the page, possibly through the
+   kernel's own mapping or while holding the file system lock,
+   without it being evicted.  If WRITE is true, the page must be
+   writable, and a copy-on-write page is unshared first.  Returns
+   true if successful, false if UADDR isn't mapped (writable) and
+   can't be brought in.  The caller should pin only a few pages
+   at a time, and unpin each with page_unpin() as soon as it is
+   done with it. */
+bool
+page_pin (const void *uaddr, bool write)
+{
+  struct thread *cur = thread_current ();
+  uint8_t *upage = pg_round_down (uaddr);
+  bool locked = page_lock ();
+  void *kpage = NULL;
+
+  if (pagedir_get_page (cur->pagedir, upage) != NULL
+      || load_page (upage, write))
+    kpage = (write
+             ? pagedir_get_writable_page (cur->pagedir, upage)
+             : pagedir_get_page (cur->pagedir, upage));
+  if (kpage != NULL)
+    frame_pin (kpage);
+  page_unlock (locked);
+  return kpage != NULL;
+}
+
+/* Unpins the page that contains user virtual address UADDR in the
+   running process, which page_pin() pinned. */
+void
+page_unpin (const void *uaddr)
+{
+  struct thread *cur = thread_current ();
+
+  frame_unpin (pagedir_get_page (cur->pagedir, pg_round_down (uaddr)));
+}
+
+/* Gives the running process its own copy of the copy-on-write
+   page that contains user virtual address UADDR.  Returns true
+   if successful, false if the page isn't copy-on-write or memory
+   is short. */
+bool
+page_unshare (const void *uaddr)
+{
+  struct thread *cur = thread_current ();
+  bool locked = page_lock ();
+  bool success = pagedir_unshare (cur->pagedir, pg_round_down (uaddr));
+
+  page_unlock (locked);
+  return success;
+}
+
+/* Brings in the page that contains user virtual address UADDR in
+   the running process, if it belongs to one of its regions and
+   isn't already present, for a write if WRITE is true or else
+   for a read.  Returns true if the page is present afterward,
+   false if UADDR isn't part of any region or if the page can't
+   be read or allocated. */
+bool
+page_load (const void *uaddr, bool write)
+{
+  bool locked = page_lock ();
+  bool success = load_page (pg_round_down (uaddr), write);
+  page_unlock (locked);
+  return success;
+}
+
+/* Returns true if UPAGE, which must be present in OWNER's
+   address space, can be evicted without writing it anywhere,
+   because it can be read again from its region. */
+bool
+page_is_clean (struct thread *owner, const void *upage)
+{
+  return (page_find_region (owner, upage) != NULL
+          && !pagedir_is_dirty (owner->pagedir, upage));
+}
+
+/* Returns true if UPAGE, which must be present in OWNER's
+   address space, maps a read-only file page that other processes
+   may share (see load_shared()).  The caller must hold OWNER's
+   vm_lock. */
+bool
+page_is_shared (struct thread *owner, const void *upage)
+{
+  return is_shared (page_find_region (owner, upage), upage);
+}
+
+/* Returns true if UPAGE, which must be present in OWNER's
+   address space, would have to go to swap to be evicted: it
+   isn't clean (see page_is_clean()), and it isn't part of a
+   mapping, whose dirty pages go back to the mapped file. */
+bool
+page_needs_swap (struct thread *owner, const void *upage)
+{
+  struct vm_region *r = page_find_region (owner, upage);
+
+  return (r == NULL
+          || (r->mapid == 0 && pagedir_is_dirty (owner->pagedir, upage)));
+}
+
+/* Removes the CNT pages starting at UPAGE, which must be present,
+   from OWNER's address space, so that their frames can be reused,
+   and records in *OUT what page_write_out() must write out.  A
+   clean page (see page_is_clean()) is just dropped, and a dirty
+   page of a mapping goes back to its file; in either case CNT
+   must be 1.  Otherwise the pages go to CNT adjacent swap slots.
+   Returns the number of pages evicted, starting at UPAGE: CNT,
+   or just 1 if swap has no run of CNT free slots, or 0 if swap
+   is full, if a page that must go back to its file can't be
+   written because the running thread holds filesys_lock, or if
+   a shared page's entry can't be dropped (see forget_shared()).
+   The caller must hold OWNER's vm_lock until page_write_out() is
+   done. */
+size_t
+page_evict (struct thread *owner, void *upage, size_t cnt,
+            struct page_out *out)
+{
+  uint32_t *pd = owner->pagedir;
+  size_t slot, i;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+  out->region = NULL;
+  out->upage = upage;
+  out->slot = SWAP_ERROR;
+  out->cnt = 1;
+  out->kpages[0] = pagedir_get_page (pd, upage);
+  if (page_is_clean (owner, upage))
+    {
+      ASSERT (cnt == 1);
+      if (!forget_shared (owner, upage))
+        return 0;
+      pagedir_clear_page (pd, upage);
+      owner->vmstat.evictions++;
+      return 1;
+    }
+  if (!page_needs_swap (owner, upage))
+    {
+      ASSERT (cnt == 1);
+      if (lock_held_by_current_thread (&filesys_lock))
+        return 0;
+      out->region = page_find_region (owner, upage);
+      pagedir_clear_page (pd, upage);
+      owner->vmstat.evictions++;
+      return 1;
+    }
+
+  slot = swap_alloc (cnt);
+  if (slot == SWAP_ERROR && cnt > 1)
+    {
+      cnt = 1;
+      slot = swap_alloc (1);
+    }
+  if (slot == SWAP_ERROR)
+    return 0;
+
+  /* Unmap the pages before writing them out, so that OWNER can't
+     change them while we wait for the disk.  If it touches one,
+     it will wait for its vm_lock, which we hold, and then read
+     the page back from swap. */
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *page = (uint8_t *) upage + i * PGSIZE;
+      out->kpages[i] = pagedir_get_page (pd, page);
+      pagedir_set_swapped (pd, page, slot + i);
+    }
+  out->slot = slot;
+  out->cnt = cnt;
+  owner->vmstat.evictions += cnt;
+  owner->vmstat.swap_outs += cnt;
+  return cnt;
+}
+
+/* Removes the page that the CNT processes in MAPPERS map at the
+   corresponding addresses in UPAGES, all to the same frame, from
+   each of their address spaces, so that the frame can be reused.
+   If the page is clean (see page_is_clean()) for every one of
+   them, it is just dropped.  Otherwise, unless DIRTY_OK is false
+   or the page is part of a mapping, it goes to a single swap
+   slot that they all share, as if they had forked after it was
+   swapped out.  Returns true if the page was evicted, recording
+   in *OUT what page_write_out() must write out, or false if it
+   was left alone.  The caller must hold each mapper's vm_lock
+   until page_write_out() is done. */
+bool
+page_evict_shared (struct thread *mappers[], void *upages[], size_t cnt,
+                   bool dirty_ok, struct page_out *out)
+{
+  void *kpage = pagedir_get_page (mappers[0]->pagedir, upages[0]);
+  size_t slot = SWAP_ERROR;
+  bool clean = true;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (!page_is_clean (mappers[i], upages[i]))
+      {
+        if (!dirty_ok || !page_needs_swap (mappers[i], upages[i]))
+          return false;
+        clean = false;
+      }
+  if (clean && !forget_shared (mappers[0], upages[0]))
+    return false;
+  if (!clean)
+    {
+      slot = swap_alloc (1);
+      if (slot == SWAP_ERROR)
+        return false;
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct thread *t = mappers[i];
+
+      if (clean)
+        pagedir_clear_page (t->pagedir, upages[i]);
+      else
+        {
+          if (i > 0)
+            swap_ref (slot);
+          pagedir_set_swapped (t->pagedir, upages[i], slot);
+          t->vmstat.swap_outs++;
+        }
+      t->vmstat.evictions++;
+    }
+  out->region = NULL;
+  out->upage = upages[0];
+  out->slot = slot;
+  out->cnt = 1;
+  out->kpages[0] = kpage;
+  return true;
+}
+
+/* Writes the pages that page_evict() or page_evict_shared() took
+   out of memory, as recorded in OUT, to swap or back to their
+   mapped file.  The caller must not hold frame_lock, since this
+   may wait for the disk. */
+void
+page_write_out (struct page_out *out)
+{
+  size_t i;
+
+  if (out->slot != SWAP_ERROR)
+    for (i = 0; i < out->cnt; i++)
+      swap_write (out->slot + i, out->kpages[i]);
+  else if (out->region != NULL)
+    {
+      lock_acquire (&filesys_lock);
+      write_back (out->region, out->upage, out->kpages[0], PGSIZE);
+      lock_release (&filesys_lock);
+    }
+}
+
+/* Stores the running process's paging statistics into *STATS. */
+void
+page_get_stats (struct vmstat *stats)
+{
+  struct thread *cur = thread_current ();
+  bool locked = page_lock ();
+
+  *stats = cur->vmstat;
+  page_unlock (locked);
+}
+
+/* Prints the running process's paging statistics. */
+void
+page_print_stats (void)
+{
+  struct thread *cur = thread_current ();
+  struct vmstat s;
+
+  page_get_stats (&s);
+  printf ("%s: faults: %"PRIu64" minor, %"PRIu64" zero, %"PRIu64" file, "
+          "%"PRIu64" swap, %"PRIu64" cow, %"PRIu64" cycles\n",
+          cur->name, s.minor_faults, s.zero_faults, s.file_faults,
+          s.swap_faults, s.cow_faults, s.fault_cycles);
+  printf ("%s: paging: %"PRIu64" evicted, %"PRIu64" swapped out\n",
+          cur->name, s.evictions, s.swap_outs);
+}
+
+/* Does the work of page_load() for page UPAGE. */
+static bool
+load_page (uint8_t *upage, bool write)
+{
+  struct thread *cur = thread_current ();
+  struct vm_region *r;
+  size_t slot;
+  bool writable;
+
+  if (pagedir_get_page (cur->pagedir, upage) != NULL)
+    {
+      count_fault (LOAD_DEMAND, &cur->vmstat.minor_faults);
+      return true;
+    }
+  if (pagedir_get_swapped (cur->pagedir, upage, &slot, &writable))
+    {
+      if (!swap_in (upage, slot, writable))
+        return false;
+      count_fault (LOAD_DEMAND, &cur->vmstat.swap_faults);
+      prefetch_swapped (upage, slot);
+      return true;
+    }
+  r = page_find_region (cur, upage);
+  if (r == NULL || !load_region_page (r, upage, LOAD_DEMAND, write))
+    return false;
+  fault_around (r, upage);
+  read_ahead (r, upage);
+  return true;
+}
+
+/* Brings in UPAGE, a page of region R that isn't present, going
+   only as far as MODE allows, for a write if WRITE is true or
+   else for a read.  Returns true if successful, false if the
+   page would take more than MODE allows or if it can't be read
+   or allocated. */
+static bool
+load_region_page (struct vm_region *r, uint8_t *upage, enum load_mode mode,
+                  bool write)
+{
+  struct thread *cur = thread_current ();
+  uint32_t *pd = cur->pagedir;
+  size_t region_ofs, page_read_bytes;
+  uint8_t *kpage;
+
+  /* Calculate how to fill this page.
+     We will read PAGE_READ_BYTES bytes from the file
+     and zero the final PGSIZE - PAGE_READ_BYTES bytes. */
+  region_ofs = upage - r->start;
+  page_read_bytes = 0;
+  if (region_ofs < r->read_bytes)
+    page_read_bytes = (r->read_bytes - region_ofs < PGSIZE
+                       ? r->read_bytes - region_ofs : PGSIZE);
+
+  if (page_read_bytes == 0 && !write)
+    {
+      if (!pagedir_share_page (pd, upage, zero_page, r->writable))
+        return false;
+      count_fault (mode, &cur->vmstat.zero_faults);
+      return true;
+    }
+  if (!r->writable && page_read_bytes > 0)
+    return load_shared (r, upage, page_read_bytes, mode);
+  if (mode == LOAD_AROUND && page_read_bytes > 0)
+    return false;
+
+  kpage = read_page (r, upage, page_read_bytes, mode);
+  if (kpage == NULL)
+    return false;
+
+  /* Add the page to the process's address space. */
+  if (!pagedir_set_page (pd, upage, kpage, r->writable))
+    {
+      frame_free (kpage);
+      return false;
+    }
+  frame_unpin (kpage);
+  count_fault (mode, (page_read_bytes > 0
+                      ? &cur->vmstat.file_faults
+                      : &cur->vmstat.zero_faults));
+  return true;
+}
+
+/* Maps the pages of region R in the FAULT_AROUND-page block
+   around UPAGE, which was just brought in, that can be had
+   without reading the disk: zero pages, and read-only file pages
+   that other processes already have in memory.  A program that
+   touches one page of a block usually touches the others soon,
+   and this saves each of them a fault. */
+static void
+fault_around (struct vm_region *r, uint8_t *upage)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  uint8_t *start = (uint8_t *) ((uintptr_t) upage
+                                & ~(uintptr_t) (FAULT_AROUND * PGSIZE - 1));
+  uint8_t *end = start + FAULT_AROUND * PGSIZE;
+  uint8_t *page;
+
+  if (start < r->start)
+    start = r->start;
+  if (end > r->end)
+    end = r->end;
+  for (page = start; page < end; page += PGSIZE)
+    if (page != upage && pagedir_get_page (pd, page) == NULL
+        && load_region_page (r, page, LOAD_AROUND, false))
+      pagedir_set_accessed (pd, page, false);
+}
+
+/* Reads ahead in region R after UPAGE, which was just brought
+   in.  A fault at the page where a sequential scan of R would
+   fault next, just past the pages already brought in, grows R's
+   read-ahead window, up to READ_AHEAD_MAX pages; any other fault
+   shrinks it back to nothing.  The pages in the window are read
+   in as long as free frames last, so that the scan finds them
+   present. */
+static void
+read_ahead (struct vm_region *r, uint8_t *upage)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  uint8_t *page;
+  size_t i;
+
+  if (upage == r->ra_next)
+    r->ra_window = (r->ra_window == 0 ? READ_AHEAD_MIN
+                    : r->ra_window * 2 > READ_AHEAD_MAX ? READ_AHEAD_MAX
+                    : r->ra_window * 2);
+  else
+    r->ra_window = 0;
+
+  page = upage + PGSIZE;
+  for (i = 0; i < r->ra_window && page < r->end; i++, page += PGSIZE)
+    if (pagedir_get_page (pd, page) == NULL)
+      {
+        if (!load_region_page (r, page, LOAD_AHEAD, false))
+          break;
+        pagedir_set_accessed (pd, page, false);
+      }
+
+  /* The scan's next fault, if it keeps going. */
+  for (page = upage + PGSIZE;
+       page < r->end && pagedir_get_page (pd, page) != NULL;
+       page += PGSIZE)
+    continue;
+  r->ra_next = page;
+}
+
+/* Brings UPAGE back from swap slot SLOT into a frame obtained
+   from frame_alloc(), mapping it read/write if WRITABLE is true,
+   and drops the page's reference to SLOT.  Returns true if
+   successful, false if no frame can be had. */
+static bool
+swap_in (uint8_t *upage, size_t slot, bool writable)
+{
+  return swap_in_frame (upage, slot, writable,
+                        frame_alloc (0, upage));
+}
+
+/* Brings in the pages that follow UPAGE in the running process
+   and were swapped out along with it, to the slots that follow
+   SLOT, as long as they belong to the same region as UPAGE (or,
+   like it, to none) and there are free frames for them.  Stops
+   short of evicting anything to make room. */
+static void
+prefetch_swapped (uint8_t *upage, size_t slot)
+{
+  struct thread *cur = thread_current ();
+  struct vm_region *r = page_find_region (cur, upage);
+  size_t i;
+
+  for (i = 1; i < SWAP_CLUSTER; i++)
+    {
+      uint8_t *next = upage + i * PGSIZE;
+      size_t next_slot;
+      bool writable;
+      void *kpage;
+
+      if (!is_user_vaddr (next)
+          || !pagedir_get_swapped (cur->pagedir, next, &next_slot, &writable)
+          || next_slot != slot + i
+          || page_find_region (cur, next) != r)
+        break;
+      kpage = frame_try_alloc (0, next);
+      if (kpage == NULL
+          || !swap_in_frame (next, next_slot, writable, kpage))
+        break;
+
+      /* Not touched yet: the clock may take it back first. */
+      pagedir_set_accessed (cur->pagedir, next, false);
+    }
+}
+
+/* Does the work of swap_in() with frame KPAGE, which may be
+   null. */
+static bool
+swap_in_frame (uint8_t *upage, size_t slot, bool writable, void *kpage)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+
+  if (kpage == NULL)
+    return false;
+  swap_read (slot, kpage);
+  if (!pagedir_set_page (pd, upage, kpage, writable))
+    {
+      frame_free (kpage);
+      return false;
+    }
+
+  /* The only copy is now in memory: evicting the page again has
+     to write it out again. */
+  pagedir_set_dirty (pd, upage, true);
+  swap_unref (slot);
+  frame_unpin (kpage);
+  return true;
+}
+
+/* Allocates a frame for UPAGE, a page of region R, and fills it
+   in.  Its first PAGE_READ_BYTES bytes come from R's file.  Only
+   a LOAD_DEMAND load may evict a frame to make room.  Returns the
+   frame, still pinned, or a null pointer if it can't be allocated
+   or read. */
+static uint8_t *
+read_page (struct vm_region *r, uint8_t *upage, size_t page_read_bytes,
+           enum load_mode mode)
+{
+  enum palloc_flags flags = page_read_bytes == 0 ? PAL_ZERO : 0;
+  size_t region_ofs = upage - r->start;
+  uint8_t *kpage;
+
+  /* Get a page of memory. */
+  kpage = (mode == LOAD_DEMAND
+           ? frame_alloc (flags, upage)
+           : frame_try_alloc (flags, upage));
+  if (kpage == NULL)
+    return NULL;
+
+  /* Load this page. */
+  if (page_read_bytes > 0)
+    {
+      off_t n;
+
+      lock_acquire (&filesys_lock);
+      n = file_read_at (r->file, kpage, page_read_bytes,
+                        r->ofs + region_ofs);
+      lock_release (&filesys_lock);
+      if (n != (off_t) page_read_bytes)
+        {
+          frame_free (kpage);
+          return NULL;
+        }
+      memset (kpage + page_read_bytes, 0, PGSIZE - page_read_bytes);
+    }
+  return kpage;
+}
+
+/* Returns true if UPAGE belongs to region R, which may be null,
+   and is a read-only page of R's file, which processes share
+   through `shared_pages'. */
+static bool
+is_shared (const struct vm_region *r, const void *upage)
+{
+  return (r != NULL && !r->writable
+          && (const uint8_t *) upage < r->start + r->read_bytes);
+}
+
+/* Maps UPAGE, a page of read-only region R whose first
+   PAGE_READ_BYTES bytes come from R's file, in the running
+   process, to the frame that other processes already map for the
+   same file page if there is one, or else, unless MODE is
+   LOAD_AROUND, to a newly read frame that later processes can
+   share.  The frame table records every process that maps the
+   frame, so that the evictor can take it from all of them.
+   Returns true if successful, false on failure. */
+static bool
+load_shared (struct vm_region *r, uint8_t *upage, size_t page_read_bytes,
+             enum load_mode mode)
+{
+  struct thread *cur = thread_current ();
+  uint32_t *pd = cur->pagedir;
+  struct shared_page key, *sp;
+  struct hash_elem *e;
+  bool success = false;
+
+  key.sector = inode_get_inumber (file_get_inode (r->file));
+  key.ofs = r->ofs + (upage - r->start);
+
+  lock_acquire (&shared_lock);
+  e = hash_find (&shared_pages, &key.hash_elem);
+  if (e != NULL)
+    {
+      sp = hash_entry (e, struct shared_page, hash_elem);
+      palloc_page_ref (sp->kpage);
+      success = pagedir_set_page (pd, upage, sp->kpage, false);
+      if (success)
+        {
+          frame_share (sp->kpage, cur, upage);
+          count_fault (mode, &cur->vmstat.minor_faults);
+        }
+      else
+        palloc_page_unref (sp->kpage);
+    }
+  else if (mode != LOAD_AROUND)
+    {
+      sp = malloc (sizeof *sp);
+      if (sp != NULL)
+        {
+          *sp = key;
+          sp->kpage = read_page (r, upage, page_read_bytes, mode);
+          if (sp->kpage != NULL
+              && pagedir_set_page (pd, upage, sp->kpage, false))
+            {
+              hash_insert (&shared_pages, &sp->hash_elem);
+              frame_unpin (sp->kpage);
+              count_fault (mode, &cur->vmstat.file_faults);
+              success = true;
+            }
+          else
+            {
+              if (sp->kpage != NULL)
+                frame_free (sp->kpage);
+              free (sp);
+            }
+        }
+    }
+  lock_release (&shared_lock);
+
+  return success;
+}
+
+/* Unmaps the pages of read-only region R that are present in the
+   running process, dropping their entries from `shared_pages'
+   along with their last mappings. */
+static void
+release_shared (struct vm_region *r)
+{
+  struct thread *cur = thread_current ();
+  uint32_t *pd = cur->pagedir;
+  uint8_t *upage;
+
+  lock_acquire (&shared_lock);
+  pagedir_batch_begin (pd);
+  for (upage = r->start; upage < r->start + r->read_bytes; upage += PGSIZE)
+    {
+      void *kpage = pagedir_get_page (pd, upage);
+
+      if (kpage == NULL)
+        continue;
+      pagedir_clear_page (pd, upage);
+      if (frame_unmap (kpage, cur, upage))
+        {
+          struct shared_page key;
+          struct hash_elem *e;
+
+          key.sector = inode_get_inumber (file_get_inode (r->file));
+          key.ofs = r->ofs + (upage - r->start);
+          e = hash_delete (&shared_pages, &key.hash_elem);
+          ASSERT (e != NULL);
+          free (hash_entry (e, struct shared_page, hash_elem));
+        }
+    }
+  pagedir_batch_end (pd);
+  lock_release (&shared_lock);
+}
+
+/* Drops the entry in `shared_pages' for UPAGE in OWNER, if it is
+   a shared page, for the evictor, which is taking the page's
+   frame away from every process that maps it.  The evictor holds
+   frame_lock, inside which shared_lock nests, so it only tries
+   to acquire shared_lock, unless the running thread already
+   holds it.  Returns true if successful or if UPAGE isn't
+   shared, false if another thread holds shared_lock. */
+static bool
+forget_shared (struct thread *owner, const void *upage)
+{
+  struct vm_region *r = page_find_region (owner, upage);
+  struct shared_page key;
+  struct hash_elem *e;
+  bool locked = false;
+
+  if (!is_shared (r, upage))
+    return true;
+  if (!lock_held_by_current_thread (&shared_lock))
+    {
+      if (!lock_try_acquire (&shared_lock))
+        return false;
+      locked = true;
+    }
+
+  key.sector = inode_get_inumber (file_get_inode (r->file));
+  key.ofs = r->ofs + ((const uint8_t *) upage - r->start);
+  e = hash_delete (&shared_pages, &key.hash_elem);
+  ASSERT (e != NULL);
+  ASSERT (hash_entry (e, struct shared_page, hash_elem)->kpage
+          == pagedir_get_page (owner->pagedir, upage));
+  free (hash_entry (e, struct shared_page, hash_elem));
+
+  if (locked)
+    lock_release (&shared_lock);
+  return true;
+}
+
+/* Creates a region as described for page_add_region() and
+   returns it, or returns a null pointer on failure. */
+static struct vm_region *
+add_region (struct file *file, off_t ofs, void *upage,
+            uint32_t read_bytes, uint32_t zero_bytes, bool writable)
+{
+  struct thread *cur = thread_current ();
+  struct vm_region *r;
+
+  ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (ofs % PGSIZE == 0);
+
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    return NULL;
+  r->start = upage;
+  r->end = r->start + read_bytes + zero_bytes;
+  r->file = read_bytes > 0 ? file : NULL;
+  r->ofs = ofs;
+  r->read_bytes = read_bytes;
+  r->writable = writable;
+  r->mapid = 0;
+  r->ra_next = NULL;
+  r->ra_window = 0;
+
+  /* Regions never overlap. */
+  if (r->start == r->end
+      || itree_overlap (&cur->regions, (uintptr_t) r->start,
+                        (uintptr_t) r->end) != NULL)
+    {
+      free (r);
+      return NULL;
+    }
+  itree_insert (&cur->regions, &r->elem,
+                (uintptr_t) r->start, (uintptr_t) r->end);
+  return r;
+}
+
+/* Writes back the dirty pages of mapping R in the running
+   process, a run of adjacent dirty pages at a time, then unmaps
+   them and closes R's file.  R must already be out of the
+   process's tree of regions. */
+static void
+unmap_region (struct vm_region *r)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  uint8_t *run = NULL;          /* First page of current dirty run. */
+  uint8_t *upage;
+
+  lock_acquire (&filesys_lock);
+  if (pd != NULL)
+    {
+      /* The pages are all mapped in a row at their user
+         addresses, so each run goes out in a single write. */
+      for (upage = r->start; upage <= r->end; upage += PGSIZE)
+        {
+          bool dirty = (upage < r->end
+                        && pagedir_get_page (pd, upage) != NULL
+                        && pagedir_is_dirty (pd, upage));
+          if (dirty && run == NULL)
+            run = upage;
+          else if (!dirty && run != NULL)
+            {
+              write_back (r, run, run, upage - run);
+              run = NULL;
+            }
+        }
+
+      pagedir_batch_begin (pd);
+      for (upage = r->start; upage < r->end; upage += PGSIZE)
+        {
+          void *kpage = pagedir_get_page (pd, upage);
+          if (kpage != NULL)
+            {
+              pagedir_clear_page (pd, upage);
+              frame_unmap (kpage, thread_current (), upage);
+            }
+        }
+      pagedir_batch_end (pd);
+    }
+  file_close (r->file);
+  lock_release (&filesys_lock);
+}
+
+/* Writes the SIZE bytes of mapping R's pages starting at UPAGE,
+   whose contents are in BUFFER, back to R's file, leaving out
+   any zero fill past the end of the file.  The caller must hold
+   filesys_lock. */
+static void
+write_back (struct vm_region *r, const uint8_t *upage, const void *buffer,
+            size_t size)
+{
+  size_t region_ofs = upage - r->start;
+
+  if (region_ofs >= r->read_bytes)
+    return;
+  if (size > r->read_bytes - region_ofs)
+    size = r->read_bytes - region_ofs;
+  file_write_at (r->file, buffer, size, r->ofs + region_ofs);
+}
+
+/* Counts a fault in the running process's statistics, by
+   incrementing *COUNTER, if MODE is LOAD_DEMAND.  Pages brought
+   in around a fault aren't faults of their own. */
+static void
+count_fault (enum load_mode mode, uint64_t *counter)
+{
+  if (mode == LOAD_DEMAND)
+    (*counter)++;
+}
+
+/* Returns a hash value for shared page E. */
+static unsigned
+shared_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct shared_page *sp = hash_entry (e, struct shared_page,
+                                             hash_elem);
+  return hash_int (sp->sector) ^ hash_int (sp->ofs);
+}
+
+/* Returns true if shared page A precedes shared page B. */
+static bool
+shared_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct shared_page *a = hash_entry (a_, struct shared_page,
+                                            hash_elem);
+  const struct shared_page *b = hash_entry (b_, struct shared_page,
+                                            hash_elem);
+  if (a->sector != b->sector)
+    return a->sector < b->sector;
+  return a->ofs < b->ofs;
+}
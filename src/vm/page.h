@@ -0,0 +1,83 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <itree.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vmstat.h>
+#include "filesys/off_t.h"
+#include "vm/swap.h"
+
+struct file;
+struct thread;
+
+/* A page-aligned range of a process's user virtual address
+   space whose pages are brought in on demand, the first time
+   they are touched.
+
+   Page I of the region, at START + I * PGSIZE, holds the bytes
+   of FILE starting at OFS + I * PGSIZE, up to READ_BYTES bytes
+   into the region, followed by zeros.  A region with no FILE (or
+   with READ_BYTES 0) is entirely zero-filled and never touches
+   the disk.
+
+   A region created by mmap() has a nonzero MAPID and its own
+   FILE, and its pages are written back to FILE, rather than to
+   swap, when they are dirty. */
+struct vm_region
+  {
+    uint8_t *start;             /* First page. */
+    uint8_t *end;               /* One past the last page. */
+    struct file *file;          /* Backing file, or null. */
+    off_t ofs;                  /* Offset of START in FILE. */
+    uint32_t read_bytes;        /* Bytes of the region read from FILE. */
+    bool writable;              /* Mapped read/write or read-only? */
+    int mapid;                  /* Mapping id, or 0 if not mmap()ed. */
+    uint8_t *ra_next;           /* Next fault of a sequential scan. */
+    size_t ra_window;           /* Pages to read ahead, 0 if random. */
+    struct itree_elem elem;     /* Element in thread's `regions'. */
+  };
+
+/* Pages that page_evict() or page_evict_shared() has taken out
+   of memory, for page_write_out() to write out. */
+struct page_out
+  {
+    struct vm_region *region;   /* Mapping to write back to, or null. */
+    void *upage;                /* User address of the first page. */
+    size_t slot;                /* First swap slot, or SWAP_ERROR. */
+    size_t cnt;                 /* Number of pages. */
+    void *kpages[SWAP_CLUSTER]; /* Frames of the pages. */
+  };
+
+/* Print each process's paging statistics when it exits?
+   Controlled by kernel command-line option "-vmstat". */
+extern bool page_exit_stats;
+
+void page_init (void);
+bool page_add_region (struct file *, off_t ofs, void *upage,
+                      uint32_t read_bytes, uint32_t zero_bytes,
+                      bool writable);
+struct vm_region *page_find_region (struct thread *, const void *uaddr);
+int page_mmap (struct file *, void *addr);
+void page_munmap (int mapid);
+bool page_copy_regions (struct thread *parent);
+void page_destroy_regions (void);
+bool page_lock (void);
+void page_unlock (bool locked);
+bool page_pin (const void *uaddr, bool write);
+void page_unpin (const void *uaddr);
+bool page_unshare (const void *uaddr);
+bool page_load (const void *uaddr, bool write);
+bool page_is_shared (struct thread *, const void *upage);
+bool page_is_clean (struct thread *, const void *upage);
+bool page_needs_swap (struct thread *, const void *upage);
+size_t page_evict (struct thread *, void *upage, size_t cnt,
+                   struct page_out *);
+bool page_evict_shared (struct thread *mappers[], void *upages[], size_t cnt,
+                        bool dirty_ok, struct page_out *);
+void page_write_out (struct page_out *);
+void page_get_stats (struct vmstat *);
+void page_print_stats (void);
+
+#endif /* vm/page.h */
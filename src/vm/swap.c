@@ -0,0 +1,130 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/* Swap space.
+
+   The swap device is divided into page-size slots.  A page that
+   is evicted and can't simply be read back from its file is
+   written to a slot, and the non-present page table entry that
+   it leaves behind records the slot number until the page is
+   brought back in (see pagedir_set_swapped()).
+
+   fork() shares a swapped-out page between parent and child by
+   copying the page table entry, so each slot has a reference
+   count, and is freed along with its last reference.
+
+   If the compressed swap cache is enabled (see vm/zswap.c),
+   slots are kept there as long as it has room, and only the
+   rest are written to the device. */
+
+/* Sectors in a slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;       /* Null if there is none. */
+static struct bitmap *used_slots;       /* Slots in use. */
+static uint16_t *ref_cnt;               /* References to each slot. */
+static struct lock swap_lock;           /* Protects the above. */
+
+/* Initializes swap space on the swap device, if there is one,
+   with a compressed cache of ZSWAP_PAGES pages in front of it. */
+void
+swap_init (size_t zswap_pages) 
+{
+  size_t slot_cnt;
+
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  slot_cnt = block_size (swap_device) / SECTORS_PER_SLOT;
+  used_slots = bitmap_create (slot_cnt);
+  ref_cnt = calloc (slot_cnt, sizeof *ref_cnt);
+  if (used_slots == NULL || (ref_cnt == NULL && slot_cnt > 0))
+    PANIC ("can't allocate swap table");
+  printf ("swap: %zu page slots on %s.\n", slot_cnt, block_name (swap_device));
+  zswap_init (slot_cnt, zswap_pages);
+}
+
+/* Allocates CNT adjacent swap slots, each with one reference, so
+   that pages written to them go out in a single sweep of the
+   disk.  Returns the first slot, or SWAP_ERROR if swap has no run
+   of CNT free slots. */
+size_t
+swap_alloc (size_t cnt) 
+{
+  size_t slot, i;
+
+  if (swap_device == NULL)
+    return SWAP_ERROR;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (used_slots, 0, cnt, false);
+  if (slot != BITMAP_ERROR)
+    for (i = 0; i < cnt; i++)
+      ref_cnt[slot + i] = 1;
+  lock_release (&swap_lock);
+
+  return slot != BITMAP_ERROR ? slot : SWAP_ERROR;
+}
+
+/* Adds a reference to SLOT, which must be in use. */
+void
+swap_ref (size_t slot) 
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  ASSERT (ref_cnt[slot] < UINT16_MAX);
+  ref_cnt[slot]++;
+  lock_release (&swap_lock);
+}
+
+/* Drops a reference to SLOT, freeing it if that was the last. */
+void
+swap_unref (size_t slot) 
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  ASSERT (ref_cnt[slot] > 0);
+  if (--ref_cnt[slot] == 0) 
+    {
+      zswap_drop (slot);
+      bitmap_reset (used_slots, slot);
+    }
+  lock_release (&swap_lock);
+}
+
+/* Writes PAGE to SLOT. */
+void
+swap_write (size_t slot, const void *page) 
+{
+  const uint8_t *p = page;
+  size_t i;
+
+  if (zswap_store (slot, page))
+    return;
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_write (swap_device, slot * SECTORS_PER_SLOT + i,
+                 p + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SLOT into PAGE. */
+void
+swap_read (size_t slot, void *page) 
+{
+  uint8_t *p = page;
+  size_t i;
+
+  if (zswap_load (slot, page))
+    return;
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_read (swap_device, slot * SECTORS_PER_SLOT + i,
+                p + i * BLOCK_SECTOR_SIZE);
+}
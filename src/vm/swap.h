@@ -0,0 +1,20 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by swap_alloc() when swap is full. */
+#define SWAP_ERROR SIZE_MAX
+
+/* Most pages swapped out, or prefetched back in, together. */
+#define SWAP_CLUSTER 8
+
+void swap_init (size_t zswap_pages);
+size_t swap_alloc (size_t cnt);
+void swap_ref (size_t slot);
+void swap_unref (size_t slot);
+void swap_write (size_t slot, const void *page);
+void swap_read (size_t slot, void *page);
+
+#endif /* vm/swap.h */
@@ -0,0 +1,283 @@
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap cache.
+
+   With the -zswap option, a pool of kernel pages sits in front
+   of the swap device.  swap_write() first offers each page to
+   zswap_store(), which compresses it and keeps it in the pool
+   under its swap slot number, and only pages that don't fit, or
+   don't compress well, go to the disk.  swap_read() checks the
+   pool first in the same way, so while the pool has room,
+   swapping a page back in costs a decompression instead of a
+   disk read.  An entry stays in the pool until its slot is
+   freed.
+
+   The pool is divided into CHUNK_SIZE-byte chunks, with a bitmap
+   of those in use, and each entry takes a run of adjacent
+   chunks.
+
+   The codec is a small LZ77 variant tuned for speed over ratio.
+   The compressed stream is a series of groups, each a control
+   byte followed by 8 items, one per control bit from the least
+   significant up.  A 0 bit is a literal byte.  A 1 bit is a
+   match: 2 bytes holding a 12-bit offset back into the output,
+   most significant bits first, and a 4-bit length less
+   MIN_MATCH.  A length field of 15 is followed by a byte that
+   adds to it, so that runs such as the zeros that fill many
+   pages take only a few bytes. */
+
+/* Size of a pool chunk, in bytes. */
+#define CHUNK_SIZE 64
+
+/* Largest compressed page worth keeping. */
+#define MAX_STORE (PGSIZE * 3 / 4)
+
+/* Codec parameters. */
+#define MIN_MATCH 3                     /* Shortest match. */
+#define MAX_MATCH (MIN_MATCH + 270)    /* Longest match. */
+#define MAX_OFFSET 4095                 /* Farthest match. */
+#define HASH_BITS 12                    /* Match finder hash size. */
+
+static uint8_t *pool;                   /* Pool, null if disabled. */
+static struct bitmap *used_chunks;      /* Chunks in use. */
+static uint32_t *entry_chunk;           /* First chunk of each slot. */
+static uint16_t *entry_size;            /* Bytes in each slot, 0 if none. */
+
+/* Compression scratch space.  A page doesn't fit on the stack. */
+static uint8_t buffer[MAX_STORE];
+static uint16_t match_table[1 << HASH_BITS];
+
+static struct lock zswap_lock;          /* Protects all of the above. */
+
+static size_t compress (const uint8_t *src, uint8_t *dst, size_t cap);
+static bool decompress (const uint8_t *src, size_t size, uint8_t *dst);
+
+/* Sets up a pool of PAGE_CNT kernel pages for compressed copies
+   of swap slots, which number SLOT_CNT.  Does nothing if
+   PAGE_CNT is 0. */
+void
+zswap_init (size_t slot_cnt, size_t page_cnt) 
+{
+  lock_init (&zswap_lock);
+  if (page_cnt == 0 || slot_cnt == 0)
+    return;
+
+  pool = palloc_get_multiple (0, page_cnt);
+  used_chunks = bitmap_create (page_cnt * (PGSIZE / CHUNK_SIZE));
+  entry_chunk = malloc (slot_cnt * sizeof *entry_chunk);
+  entry_size = calloc (slot_cnt, sizeof *entry_size);
+  if (pool == NULL || used_chunks == NULL || entry_chunk == NULL
+      || entry_size == NULL)
+    PANIC ("can't allocate %zu-page compressed swap pool", page_cnt);
+  printf ("zswap: %zu page pool.\n", page_cnt);
+}
+
+/* Compresses PAGE and keeps it in the pool as the contents of
+   swap slot SLOT.  Returns true if successful, false if the pool
+   is disabled or full, or PAGE doesn't compress well enough to
+   be worth it, in which case it should go to disk. */
+bool
+zswap_store (size_t slot, const void *page) 
+{
+  size_t size, chunk;
+
+  if (pool == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  ASSERT (entry_size[slot] == 0);
+  size = compress (page, buffer, sizeof buffer);
+  chunk = BITMAP_ERROR;
+  if (size > 0)
+    chunk = bitmap_scan_and_flip (used_chunks, 0,
+                                  DIV_ROUND_UP (size, CHUNK_SIZE), false);
+  if (chunk != BITMAP_ERROR) 
+    {
+      memcpy (pool + chunk * CHUNK_SIZE, buffer, size);
+      entry_chunk[slot] = chunk;
+      entry_size[slot] = size;
+    }
+  lock_release (&zswap_lock);
+
+  return chunk != BITMAP_ERROR;
+}
+
+/* Decompresses swap slot SLOT into PAGE, if the pool holds it.
+   The pool keeps its copy until zswap_drop().  Returns true if
+   successful, false if SLOT isn't in the pool. */
+bool
+zswap_load (size_t slot, void *page) 
+{
+  bool stored;
+
+  if (pool == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  stored = entry_size[slot] > 0;
+  if (stored && !decompress (pool + entry_chunk[slot] * CHUNK_SIZE,
+                             entry_size[slot], page))
+    PANIC ("zswap: slot %zu is corrupt", slot);
+  lock_release (&zswap_lock);
+
+  return stored;
+}
+
+/* Frees the pool's copy of swap slot SLOT, if it has one. */
+void
+zswap_drop (size_t slot) 
+{
+  if (pool == NULL)
+    return;
+
+  lock_acquire (&zswap_lock);
+  if (entry_size[slot] > 0) 
+    {
+      bitmap_set_multiple (used_chunks, entry_chunk[slot],
+                           DIV_ROUND_UP (entry_size[slot], CHUNK_SIZE),
+                           false);
+      entry_size[slot] = 0;
+    }
+  lock_release (&zswap_lock);
+}
+
+/* Returns a hash of the MIN_MATCH bytes at P. */
+static inline unsigned
+hash_bytes (const uint8_t *p) 
+{
+  uint32_t x = p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16);
+  return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Compresses the PGSIZE bytes at SRC into DST, which has room
+   for CAP bytes.  Returns the compressed size, or 0 if it
+   doesn't fit. */
+static size_t
+compress (const uint8_t *src, uint8_t *dst, size_t cap) 
+{
+  const uint8_t *ip = src;
+  const uint8_t *end = src + PGSIZE;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + cap;
+  uint8_t *ctrl = NULL;
+  unsigned bit = 8;
+
+  /* MATCH_TABLE holds positions in SRC.  Entries left over from
+     earlier pages are harmless, since every candidate is checked
+     before it is used. */
+  while (ip < end) 
+    {
+      size_t pos = ip - src;
+
+      if (bit == 8) 
+        {
+          if (op >= op_end)
+            return 0;
+          ctrl = op++;
+          *ctrl = 0;
+          bit = 0;
+        }
+
+      if (end - ip >= MIN_MATCH) 
+        {
+          unsigned h = hash_bytes (ip);
+          size_t cand = match_table[h];
+
+          match_table[h] = pos;
+          if (cand < pos && pos - cand <= MAX_OFFSET
+              && !memcmp (src + cand, ip, MIN_MATCH)) 
+            {
+              const uint8_t *m = src + cand;
+              size_t len = MIN_MATCH;
+              size_t ofs = pos - cand;
+
+              while (ip + len < end && len < MAX_MATCH && m[len] == ip[len])
+                len++;
+              if (op_end - op < 3)
+                return 0;
+              *op++ = ofs >> 4;
+              if (len - MIN_MATCH < 15)
+                *op++ = (ofs & 0xf) << 4 | (len - MIN_MATCH);
+              else 
+                {
+                  *op++ = (ofs & 0xf) << 4 | 15;
+                  *op++ = len - MIN_MATCH - 15;
+                }
+              *ctrl |= 1 << bit++;
+              ip += len;
+              continue;
+            }
+        }
+
+      if (op >= op_end)
+        return 0;
+      *op++ = *ip++;
+      bit++;
+    }
+  return op - dst;
+}
+
+/* Decompresses the SIZE bytes at SRC, produced by compress(),
+   into the PGSIZE bytes at DST.  Returns true if successful,
+   false if SRC is malformed. */
+static bool
+decompress (const uint8_t *src, size_t size, uint8_t *dst) 
+{
+  const uint8_t *ip = src;
+  const uint8_t *end = src + size;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + PGSIZE;
+
+  while (op < op_end) 
+    {
+      unsigned ctrl, bit;
+
+      if (ip >= end)
+        return false;
+      ctrl = *ip++;
+      for (bit = 0; bit < 8 && op < op_end; bit++) 
+        {
+          if (ctrl & (1u << bit)) 
+            {
+              size_t ofs, len;
+
+              if (end - ip < 2)
+                return false;
+              ofs = (ip[0] << 4) | (ip[1] >> 4);
+              len = (ip[1] & 0xf) + MIN_MATCH;
+              ip += 2;
+              if (len == MIN_MATCH + 15) 
+                {
+                  if (ip >= end)
+                    return false;
+                  len += *ip++;
+                }
+              if (ofs == 0 || ofs > (size_t) (op - dst)
+                  || len > (size_t) (op_end - op))
+                return false;
+
+              /* Byte by byte, since the match may overlap its own
+                 output. */
+              for (; len > 0; len--, op++)
+                *op = op[-ofs];
+            }
+          else 
+            {
+              if (ip >= end)
+                return false;
+              *op++ = *ip++;
+            }
+        }
+    }
+  return ip == end;
+}